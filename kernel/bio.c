@@ -1,13 +1,25 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// The cache is sized at boot to 1/BCACHEDIV of free memory, and
+// its buffers, hash buckets and block data all live in pages from
+// kalloc.c.
+//
+// Each hash bucket has its own lock, so lookups of different
+// blocks on different CPUs don't contend. Recycling a buffer
+// for a new block takes bcache.lock as well, so that only one
+// CPU at a time moves buffers between buckets; it takes the
+// unused buffer released longest ago from the head of an LRU
+// list of the buffers nobody holds a reference to.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * After changing buffer data, call bwrite to write it to disk,
+//     or bwritestart to start several writes and bwait for each.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -22,65 +34,207 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define BUCKET(dev, blockno) (&bcache.bucket[((dev) * 31 + (blockno)) % bcache.nbucket])
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;  // the bucket's buffers, through next
+  int nhit;          // lookups that found their block here
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct spinlock lock;  // serializes recycling
+  // the unreferenced buffers, least recently used first,
+  // through lruprev and lrunext. Lock order: a bucket's lock,
+  // then lrulock.
+  struct spinlock lrulock;
+  struct buf lru;
+  struct buf *buf;
+  int nbuf;
+  struct bucket *bucket;
+  int nbucket;
+  int nmiss;   // lookups that had to recycle a buffer
+  int nevict;  // recycled buffers that held a block
+  int nahead;  // read-aheads started
 } bcache;
 
 void binit(void) {
+  struct bucket *bk;
   struct buf *b;
+  char *data = 0;
+  uint64 sz;
+  int order;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.lrulock, "bcache.lru");
+  bcache.lru.lruprev = bcache.lru.lrunext = &bcache.lru;
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // Give the cache 1/BCACHEDIV of free memory for block data,
+  // and a hash bucket for every two buffers. The log must be able
+  // to pin a whole transaction's blocks (NBUF); on the default
+  // 128 MB machine that is about 460 of some 8000 buffers.
+  bcache.nbuf = buddy_freepages() / BCACHEDIV * (PGSIZE / BSIZE);
+  if (bcache.nbuf < NBUF) panic("binit: cache smaller than NBUF");
+  bcache.nbucket = bcache.nbuf / 2 + 1;
+  sz = bcache.nbuf * sizeof(struct buf) + bcache.nbucket * sizeof(struct bucket);
+  for (order = 0; ((uint64)PGSIZE << order) < sz; order++)
+    ;
+  if (order > MAXORDER || (bcache.buf = kallocpages(order)) == 0) panic("binit");
+  bcache.bucket = (struct bucket *)(bcache.buf + bcache.nbuf);
+
+  for (bk = bcache.bucket; bk < bcache.bucket + bcache.nbucket; bk++) {
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head = 0;
+    bk->nhit = 0;
+  }
+
+  // Until it is first used, buffer i stands for block i of
+  // (non-existent) device 0, which spreads them over the buckets.
+  for (b = bcache.buf; b < bcache.buf + bcache.nbuf; b++) {
+    if ((b - bcache.buf) % (PGSIZE / BSIZE) == 0 && (data = kalloc()) == 0) panic("binit");
+    b->data = (uchar *)data + (b - bcache.buf) % (PGSIZE / BSIZE) * BSIZE;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->valid = 0;
+    b->dev = 0;
+    b->blockno = b - bcache.buf;
+    b->refcnt = 0;
+    bk = BUCKET(b->dev, b->blockno);
+    b->next = bk->head;
+    bk->head = b;
+    b->lrunext = &bcache.lru;
+    b->lruprev = bcache.lru.lruprev;
+    bcache.lru.lruprev->lrunext = b;
+    bcache.lru.lruprev = b;
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
-static struct buf *bget(uint dev, uint blockno) {
-  struct buf *b;
+// Take a reference to b, taking it off the LRU list if it
+// had none. Caller must hold b's bucket lock.
+static void bhold(struct buf *b) {
+  if (b->refcnt++ == 0) {
+    acquire(&bcache.lrulock);
+    b->lruprev->lrunext = b->lrunext;
+    b->lrunext->lruprev = b->lruprev;
+    release(&bcache.lrulock);
+  }
+}
 
-  acquire(&bcache.lock);
+// Drop a reference to b, putting it at the tail of the LRU list
+// if that was the last. Caller must hold b's bucket lock.
+static void bdrop(struct buf *b) {
+  if (--b->refcnt == 0) {
+    acquire(&bcache.lrulock);
+    b->lrunext = &bcache.lru;
+    b->lruprev = bcache.lru.lruprev;
+    bcache.lru.lruprev->lrunext = b;
+    bcache.lru.lruprev = b;
+    release(&bcache.lrulock);
+  }
+}
 
-  // Is the block already cached?
-  for (b = bcache.head.next; b != &bcache.head; b = b->next) {
+// Find the buffer for block blockno on dev in bucket bk,
+// and take a reference to it. Caller must hold bk->lock.
+static struct buf *blookup(struct bucket *bk, uint dev, uint blockno) {
+  struct buf *b;
+
+  for (b = bk->head; b != 0; b = b->next) {
     if (b->dev == dev && b->blockno == blockno) {
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+      bhold(b);
+      bk->nhit++;
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for (b = bcache.head.prev; b != &bcache.head; b = b->prev) {
-    if (b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+// Take the unused buffer released longest ago out of its bucket,
+// with a reference to it. Caller must hold bcache.lock, so no
+// other CPU changes which block a buffer holds.
+static struct buf *brecycle(void) {
+  struct buf *victim, **pp;
+  struct bucket *bk;
+
+  for (;;) {
+    // the first buffer on the LRU list that the disk is done
+    // with; only the few read-aheads in flight are skipped.
+    acquire(&bcache.lrulock);
+    for (victim = bcache.lru.lrunext; victim != &bcache.lru && victim->disk; victim = victim->lrunext)
+      ;
+    release(&bcache.lrulock);
+    if (victim == &bcache.lru) panic("bget: no buffers");
+
+    bk = BUCKET(victim->dev, victim->blockno);
+    acquire(&bk->lock);
+    if (victim->refcnt == 0 && victim->disk == 0) break;
+    // someone looked it up since we checked; try again.
+    release(&bk->lock);
+  }
+  bhold(victim);
+
+  for (pp = &bk->head; *pp != victim; pp = &(*pp)->next)
+    ;
+  *pp = victim->next;
+  if (victim->valid) bcache.nevict++;
+  release(&bk->lock);
+  return victim;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return the buffer with a reference
+// taken, but not locked.
+static struct buf *bref(uint dev, uint blockno) {
+  struct bucket *bk = BUCKET(dev, blockno);
+  struct buf *b;
+
+  // Is the block already cached?
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if (b) return b;
+
+  // Not cached. Only one CPU at a time recycles buffers,
+  // so check again in case another CPU just cached the
+  // block while we weren't holding bk->lock.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if (b) {
+    release(&bcache.lock);
+    return b;
   }
-  panic("bget: no buffers");
+
+  b = brecycle();
+  bcache.nmiss++;
+
+  acquire(&bk->lock);
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->next = bk->head;
+  bk->head = b;
+  release(&bk->lock);
+  release(&bcache.lock);
+  return b;
+}
+
+// Drop a reference taken by bref(), without the buffer's lock.
+static void bput(struct buf *b) {
+  struct bucket *bk = BUCKET(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  bdrop(b);
+  release(&bk->lock);
+}
+
+// Return a locked buffer for block blockno on dev.
+static struct buf *bget(uint dev, uint blockno) {
+  struct buf *b;
+
+  b = bref(dev, blockno);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -89,48 +243,101 @@ struct buf *bread(uint dev, uint blockno) {
 
   b = bget(dev, blockno);
   if (!b->valid) {
-    virtio_disk_rw(b, 0);
-    b->valid = 1;
+    // a read-ahead of the block may still be in flight.
+    virtio_disk_wait(b);
+    if (!b->valid) {
+      virtio_disk_rw(b, 0);
+      b->valid = 1;
+    }
   }
   return b;
 }
 
+// Start reading the n indicated blocks into the cache,
+// without waiting for them. Consecutive blocks go to the
+// disk together. Blocks whose buffers are busy are skipped:
+// someone is using them, and waiting for them while holding
+// the other buffers' locks could deadlock.
+void breadahead(uint dev, uint *blockno, int n) {
+  struct buf *b, *rd[NREADAHEAD];
+  int i, nrd = 0;
+
+  for (i = 0; i < n && nrd < NREADAHEAD; i++) {
+    b = bref(dev, blockno[i]);
+    if (!tryacquiresleep(&b->lock)) {
+      bput(b);
+      continue;
+    }
+    if (!b->valid && !b->disk)
+      rd[nrd++] = b;
+    else
+      brelse(b);
+  }
+  if (nrd == 0) return;
+  virtio_disk_start(rd, nrd, 0);
+  bcache.nahead += nrd;
+  for (i = 0; i < nrd; i++) brelse(rd[i]);
+}
+
 // Write b's contents to disk.  Must be locked.
 void bwrite(struct buf *b) {
   if (!holdingsleep(&b->lock)) panic("bwrite");
   virtio_disk_rw(b, 1);
 }
 
+// Start writing the contents of the n buffers in b to disk,
+// without waiting. Runs of consecutive blocks go to the disk
+// together. Each buffer must stay locked until bwait() says
+// its write is done.
+void bwritestart(struct buf **b, int n) {
+  for (int i = 0; i < n; i++)
+    if (!holdingsleep(&b[i]->lock)) panic("bwritestart");
+  virtio_disk_start(b, n, 1);
+}
+
+// Wait for the disk to finish with b.
+void bwait(struct buf *b) {
+  if (!holdingsleep(&b->lock)) panic("bwait");
+  virtio_disk_wait(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// If no one else holds it, it goes to the tail of the LRU list.
 void brelse(struct buf *b) {
   if (!holdingsleep(&b->lock)) panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-
-  release(&bcache.lock);
+  bput(b);
 }
 
 void bpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt++;
-  release(&bcache.lock);
+  struct bucket *bk = BUCKET(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  bhold(b);
+  release(&bk->lock);
 }
 
 void bunpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt--;
-  release(&bcache.lock);
+  struct bucket *bk = BUCKET(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  bdrop(b);
+  release(&bk->lock);
+}
+
+// Format the cache's counters into buf, for the statistics device.
+int biostats(char *buf, int sz) {
+  int n, nhit = 0, nacq = 0, ntas = 0;
+
+  for (struct bucket *bk = bcache.bucket; bk < bcache.bucket + bcache.nbucket; bk++) {
+    nhit += bk->nhit;
+    nacq += bk->lock.n;
+    ntas += bk->lock.nts;
+  }
+  n = snprintf(buf, sz, "bcache: buffers %d hit %d miss %d evict %d read-ahead %d\n", bcache.nbuf, nhit, bcache.nmiss,
+               bcache.nevict, bcache.nahead);
+  n += snprintf(buf + n, sz - n, "bcache: #acquire() %d #test-and-set %d recycle #acquire() %d #test-and-set %d\n",
+                nacq, ntas, bcache.lock.n, bcache.lock.nts);
+  return n;
 }
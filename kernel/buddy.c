@@ -0,0 +1,185 @@
+// Buddy allocator for physically contiguous runs of pages.
+//
+// Free memory is kept as blocks of 2^order pages, each aligned to
+// its own size in physical memory, on one free list per order.
+// Allocating an order-k block splits the smallest larger free block
+// as often as needed; freeing a block merges it with its buddy (the
+// other half of the block it was split from) for as long as the
+// buddy is free too, so large blocks re-form as memory is returned.
+//
+// kalloc.c's per-CPU page caches sit on top of this allocator and
+// move order-0 pages in and out of it in batches.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NPAGE ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PFN(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PFN2PA(pfn) (KERNBASE + (uint64)(pfn) * PGSIZE)
+#define NOTFREE 0xff  // buddy.order[] value for pages not heading a free block
+
+struct block {
+  struct block *next;
+  struct block *prev;
+};
+
+struct {
+  struct spinlock lock;
+  struct block free[MAXORDER + 1];  // circular list heads, one per order
+  int nfree[MAXORDER + 1];          // blocks on each list
+  uint64 base;                      // first managed physical address
+  uint64 top;                       // one past the last
+  uchar order[NPAGE];               // order of the free block starting at each page
+} buddy;
+
+static void push(struct block *b, int order) {
+  struct block *head = &buddy.free[order];
+
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+  buddy.nfree[order]++;
+  buddy.order[PFN(b)] = order;
+}
+
+static void detach(struct block *b, int order) {
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+  buddy.nfree[order]--;
+  buddy.order[PFN(b)] = NOTFREE;
+}
+
+// Hand the pages in [pa_start, pa_end) to the allocator,
+// as the largest aligned blocks that fit.
+void buddyinit(void *pa_start, void *pa_end) {
+  uint64 pa;
+  int k;
+
+  initlock(&buddy.lock, "buddy");
+  for (k = 0; k <= MAXORDER; k++) {
+    buddy.free[k].next = buddy.free[k].prev = &buddy.free[k];
+    buddy.nfree[k] = 0;
+  }
+  memset(buddy.order, NOTFREE, sizeof(buddy.order));
+  buddy.base = PGROUNDUP((uint64)pa_start);
+  buddy.top = PGROUNDDOWN((uint64)pa_end);
+
+  for (pa = buddy.base; pa < buddy.top; pa += (uint64)PGSIZE << k) {
+    for (k = MAXORDER; k > 0; k--) {
+      if (PFN(pa) % (1 << k) == 0 && pa + ((uint64)PGSIZE << k) <= buddy.top) break;
+    }
+    push((struct block *)pa, k);
+  }
+}
+
+// Allocate a block of 2^order physically contiguous pages,
+// aligned to its size. Returns 0 if no such block is free.
+// The contents are not initialized.
+void *buddy_alloc(int order) {
+  struct block *b;
+  int k;
+
+  if (order < 0 || order > MAXORDER) panic("buddy_alloc");
+
+  acquire(&buddy.lock);
+  for (k = order; k <= MAXORDER && buddy.nfree[k] == 0; k++)
+    ;
+  if (k > MAXORDER) {
+    release(&buddy.lock);
+    return 0;
+  }
+  b = buddy.free[k].next;
+  detach(b, k);
+  // Split, keeping the lower half and freeing the upper one.
+  while (k > order) {
+    k--;
+    push((struct block *)((char *)b + ((uint64)PGSIZE << k)), k);
+  }
+  release(&buddy.lock);
+  return (void *)b;
+}
+
+// Allocate up to n single pages into pa[] under one lock
+// acquisition. Returns how many were allocated.
+int buddy_allocv(void **pa, int n) {
+  struct block *b;
+  int i, k;
+
+  acquire(&buddy.lock);
+  for (i = 0; i < n; i++) {
+    for (k = 0; k <= MAXORDER && buddy.nfree[k] == 0; k++)
+      ;
+    if (k > MAXORDER) break;
+    b = buddy.free[k].next;
+    detach(b, k);
+    while (k > 0) {
+      k--;
+      push((struct block *)((char *)b + ((uint64)PGSIZE << k)), k);
+    }
+    pa[i] = b;
+  }
+  release(&buddy.lock);
+  return i;
+}
+
+// Return a block to its free list, merging with its buddy.
+// Caller must hold buddy.lock.
+static void buddy_free1(void *pa, int order) {
+  uint64 pfn, bpfn, bpa;
+
+  if ((uint64)pa % ((uint64)PGSIZE << order) != 0 || (uint64)pa < buddy.base || (uint64)pa >= buddy.top)
+    panic("buddy_free");
+  pfn = PFN(pa);
+  if (buddy.order[pfn] != NOTFREE) panic("buddy_free: double free");
+
+  for (; order < MAXORDER; order++) {
+    bpfn = pfn ^ (1 << order);
+    bpa = PFN2PA(bpfn);
+    if (bpa < buddy.base || bpa + ((uint64)PGSIZE << order) > buddy.top) break;
+    if (buddy.order[bpfn] != order) break;  // buddy is not a free block of this size
+    detach((struct block *)bpa, order);
+    if (bpfn < pfn) pfn = bpfn;
+  }
+  push((struct block *)PFN2PA(pfn), order);
+}
+
+// Free a block of 2^order pages returned by buddy_alloc().
+void buddy_free(void *pa, int order) {
+  if (order < 0 || order > MAXORDER) panic("buddy_free");
+
+  acquire(&buddy.lock);
+  buddy_free1(pa, order);
+  release(&buddy.lock);
+}
+
+// Free n single pages under one lock acquisition.
+void buddy_freev(void **pa, int n) {
+  acquire(&buddy.lock);
+  for (int i = 0; i < n; i++) buddy_free1(pa[i], 0);
+  release(&buddy.lock);
+}
+
+// Return the number of free pages.
+int buddy_freepages(void) {
+  int n = 0;
+
+  acquire(&buddy.lock);
+  for (int k = 0; k <= MAXORDER; k++) n += buddy.nfree[k] << k;
+  release(&buddy.lock);
+  return n;
+}
+
+// Format the free block counts into buf, for the statistics device.
+int buddystats(char *buf, int sz) {
+  int n;
+
+  n = snprintf(buf, sz, "buddy: #acquire() %d #test-and-set %d free blocks by order:", buddy.lock.n, buddy.lock.nts);
+  for (int k = 0; k <= MAXORDER; k++) n += snprintf(buf + n, sz - n, " %d", buddy.nfree[k]);
+  n += snprintf(buf + n, sz - n, "\n");
+  return n;
+}
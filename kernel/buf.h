@@ -5,8 +5,9 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
-  uchar data[BSIZE];
+  struct buf *next;    // hash bucket list
+  struct buf *lruprev; // LRU list of unreferenced buffers
+  struct buf *lrunext;
+  uchar *data;         // BSIZE bytes, sharing a page with other bufs
 };
 
@@ -0,0 +1,130 @@
+// Directory name cache.
+//
+// Remembers what dirlookup() found: for a directory and a name,
+// the inode number the name refers to and the offset of its
+// directory entry, or that the directory has no such name
+// (inum 0). A lookup that hits needn't read the directory.
+//
+// The cache is set-associative: a directory and name hash to
+// one set of NDCWAY entries, and a new entry replaces the one
+// in its set used longest ago.
+//
+// An entry is only entered, changed or relied on by a caller
+// holding the directory's lock, so it always agrees with the
+// directory: dirlink() and unlink record what they change, and
+// iput() forgets the entries of a directory it frees.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define NDCWAY 4
+#define NDCSET (NDCACHE / NDCWAY)
+
+struct dcentry {
+  uint dev;
+  uint dinum;  // directory's inode number; 0 if the entry is unused
+  char name[DIRSIZ];
+  uint inum;  // 0 if the directory has no such name
+  uint off;   // offset of the directory entry, if inum != 0
+  uint used;  // dcache.clock when last used
+};
+
+struct {
+  struct spinlock lock;
+  struct dcentry e[NDCSET][NDCWAY];
+  uint clock;
+  int nhit;
+  int nneg;  // hits on entries for absent names
+  int nmiss;
+} dcache;
+
+void dcinit(void) { initlock(&dcache.lock, "dcache"); }
+
+static struct dcentry *dcset(uint dev, uint dinum, char *name) {
+  uint h = dev * 31 + dinum;
+
+  for (int i = 0; i < DIRSIZ && name[i]; i++) h = h * 31 + (uchar)name[i];
+  return dcache.e[h % NDCSET];
+}
+
+// Find the entry for name in dp, in set s. Caller holds dcache.lock.
+static struct dcentry *dcfind(struct dcentry *s, struct inode *dp, char *name) {
+  for (struct dcentry *e = s; e < s + NDCWAY; e++) {
+    if (e->dinum == dp->inum && e->dev == dp->dev && namecmp(e->name, name) == 0) return e;
+  }
+  return 0;
+}
+
+// Look up name in directory dp. If the cache knows, return 1 and
+// set *inum, 0 if dp has no entry for name, and *off; else return 0.
+// Caller must hold dp->lock.
+int dclookup(struct inode *dp, char *name, uint *inum, uint *off) {
+  struct dcentry *e;
+
+  acquire(&dcache.lock);
+  if ((e = dcfind(dcset(dp->dev, dp->inum, name), dp, name)) == 0) {
+    dcache.nmiss++;
+    release(&dcache.lock);
+    return 0;
+  }
+  e->used = ++dcache.clock;
+  *inum = e->inum;
+  *off = e->off;
+  if (e->inum)
+    dcache.nhit++;
+  else
+    dcache.nneg++;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp refers to inum, in the
+// directory entry at off, or that dp has no entry for name if
+// inum is 0. Caller must hold dp->lock.
+void dcenter(struct inode *dp, char *name, uint inum, uint off) {
+  struct dcentry *s, *e;
+
+  acquire(&dcache.lock);
+  s = dcset(dp->dev, dp->inum, name);
+  if ((e = dcfind(s, dp, name)) == 0) {
+    // an unused entry, or else the one used longest ago.
+    e = s;
+    for (struct dcentry *f = s; f < s + NDCWAY; f++) {
+      if (f->dinum == 0) {
+        e = f;
+        break;
+      }
+      if (f->used < e->used) e = f;
+    }
+    e->dev = dp->dev;
+    e->dinum = dp->inum;
+    strncpy(e->name, name, DIRSIZ);
+  }
+  e->inum = inum;
+  e->off = off;
+  e->used = ++dcache.clock;
+  release(&dcache.lock);
+}
+
+// Forget the entries of directory dinum on dev, which is being freed.
+void dcpurge(uint dev, uint dinum) {
+  struct dcentry *e;
+
+  acquire(&dcache.lock);
+  for (e = &dcache.e[0][0]; e < &dcache.e[0][0] + NDCSET * NDCWAY; e++) {
+    if (e->dinum == dinum && e->dev == dev) e->dinum = 0;
+  }
+  release(&dcache.lock);
+}
+
+// Format the cache's counters into buf, for the statistics device.
+int dcachestats(char *buf, int sz) {
+  return snprintf(buf, sz, "dcache: entries %d hit %d negative hit %d miss %d\n", NDCACHE, dcache.nhit, dcache.nneg,
+                  dcache.nmiss);
+}
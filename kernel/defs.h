@@ -14,8 +14,12 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritestart(struct buf**, int);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             biostats(char*, int);
+void            breadahead(uint, uint*, int);
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +28,9 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execload(struct proc*, uint64, char*);
+void            exectrim(struct proc*, uint64);
+void            execprefault(uint64, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -34,18 +41,29 @@ int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
 
+// dcache.c
+void            dcinit(void);
+int             dclookup(struct inode*, char*, uint*, uint*);
+void            dcenter(struct inode*, char*, uint, uint);
+void            dcpurge(uint, uint);
+int             dcachestats(char*, int);
+
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+int             iexecbegin(struct inode*);
+void            iexecend(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+int             iwritebegin(struct inode*);
+void            iwriteend(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
@@ -53,6 +71,7 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+int             icachestats(char*, int);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -61,14 +80,35 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kzalloc(void);
+int             kzeroidle(void);
+void            kdup(void*);
+int             krefcnt(void*);
 void            kfree(void *);
+void*           kallocpages(int);
+void            kfreepages(void *, int);
 void            kinit(void);
+int             kallocstats(char*, int);
+
+// buddy.c
+void            buddyinit(void*, void*);
+void*           buddy_alloc(int);
+int             buddy_allocv(void**, int);
+void            buddy_free(void*, int);
+void            buddy_freev(void**, int);
+int             buddy_freepages(void);
+int             buddystats(char*, int);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_order(struct buf*);
+void            log_bfree(uint);
+int             log_canreuse(uint);
 void            begin_op(void);
 void            end_op(void);
+int             logstats(char*, int);
+void            logtick(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -101,6 +141,8 @@ struct proc*    myproc();
 void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+int             schedtick(void);
+int             setpriority(int, int);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
@@ -110,10 +152,20 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             schedstats(char*, int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// copyuser.S
+int             copyuser(void*, void*, uint64);
+int             copyuserstr(char*, char*, uint64);
+
+// vmcopyin.c
+int             copyin_new(char*, uint64, uint64);
+int             copyout_new(uint64, char*, uint64);
+int             copyinstr_new(char*, uint64, uint64);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -124,10 +176,17 @@ void            pop_off(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// sprintf.c
+int             snprintf(char*, int, char*, ...);
+
+// stats.c
+void            statsinit(void);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -151,6 +210,9 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            timeroff(void);
+void            timeron(void);
+void            timerkick(int);
 
 // uart.c
 void            uartinit(void);
@@ -163,6 +225,11 @@ int             uartgetc(void);
 void            kvminit(void);
 void            kvminithart(void);
 uint64          kvmpa(uint64);
+int             kvmstats(char*, int);
+pagetable_t     kvmcreate(pagetable_t);
+void            kvmsetuser(pagetable_t, pagetable_t);
+int             uvmkshare(pagetable_t);
+void            uvmkunshare(pagetable_t);
 void            kvmmap(uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
@@ -170,6 +237,7 @@ void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmfault(pagetable_t, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -187,7 +255,10 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
+int             virtio_disk_stats(char*, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -14,8 +14,10 @@ int exec(char *path, char **argv) {
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG + 1], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct seg seg[NSEG];
+  int nseg = 0;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -39,14 +41,28 @@ int exec(char *path, char **argv) {
     if (ph.type != ELF_PROG_LOAD) continue;
     if (ph.memsz < ph.filesz) goto bad;
     if (ph.vaddr + ph.memsz < ph.vaddr) goto bad;
+    if (ph.vaddr + ph.memsz > USERTOP) goto bad;
+    if (ph.vaddr % PGSIZE != 0) goto bad;
+    if (nseg < NSEG) {
+      // Map nothing yet; uvmfault() reads pages in as they are touched.
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].filesz = ph.filesz;
+      seg[nseg].off = ph.off;
+      nseg++;
+      if (ph.vaddr + ph.memsz > sz) sz = ph.vaddr + ph.memsz;
+      continue;
+    }
     uint64 sz1;
     if ((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0) goto bad;
     sz = sz1;
-    if (ph.vaddr % PGSIZE != 0) goto bad;
     if (loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0) goto bad;
   }
-  iunlockput(ip);
+  // Keep a reference to the executable for the segments, and
+  // keep it from being written while they are read in.
+  if (iexecbegin(ip) < 0) goto bad;
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
   p = myproc();
@@ -91,11 +107,22 @@ int exec(char *path, char **argv) {
 
   // Commit to the user image.
   oldpagetable = p->pagetable;
+  oldexe = p->exe;
   p->pagetable = pagetable;
+  kvmsetuser(p->kpagetable, pagetable);
   p->sz = sz;
+  p->exe = exe;
+  memmove(p->seg, seg, sizeof(seg));
+  p->nseg = nseg;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp;          // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  if (oldexe) {
+    iexecend(oldexe);
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
 
   return argc;  // this ends up in a0, the first argument to main(argc, argv)
 
@@ -105,9 +132,73 @@ bad:
     iunlockput(ip);
     end_op();
   }
+  if (exe) {
+    iexecend(exe);
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
+// Fill mem, the new page for user address va of process p,
+// from the executable if va lies in one of p's segments.
+// Returns 0 on success, or -1 if the page can't be read,
+// including when the caller holds a spinlock, since
+// reading the executable may sleep.
+int execload(struct proc *p, uint64 va, char *mem) {
+  struct seg *s;
+  uint64 n;
+  int held, r;
+
+  for (s = p->seg; s < &p->seg[p->nseg]; s++) {
+    if (va < s->va || va >= s->va + s->filesz) continue;
+
+    push_off();
+    held = mycpu()->noff > 1;
+    pop_off();
+    if (held) return -1;
+
+    n = s->va + s->filesz - va;
+    if (n > PGSIZE) n = PGSIZE;
+    ilock(p->exe);
+    r = readi(p->exe, 0, (uint64)mem, s->off + (va - s->va), n);
+    iunlock(p->exe);
+    return r == n ? 0 : -1;
+  }
+  return 0;
+}
+
+// Forget segment contents at and above sz, after p shrank, so
+// that those addresses read as zero if the process grows again.
+void exectrim(struct proc *p, uint64 sz) {
+  struct seg *s;
+
+  for (s = p->seg; s < &p->seg[p->nseg]; s++) {
+    if (s->va >= sz)
+      s->filesz = 0;
+    else if (s->va + s->filesz > sz)
+      s->filesz = sz - s->va;
+  }
+}
+
+// Read in any pages of the current process's segments that lie
+// in [va, va+n), so that a system call can copy to or from the
+// range later, while it holds locks.
+void execprefault(uint64 va, uint64 n) {
+  struct proc *p = myproc();
+  struct seg *s;
+  uint64 a, end;
+
+  if (va + n < va) return;
+  for (s = p->seg; s < &p->seg[p->nseg]; s++) {
+    a = PGROUNDDOWN(va > s->va ? va : s->va);
+    end = va + n < s->va + s->filesz ? va + n : s->va + s->filesz;
+    for (; a < end; a += PGSIZE)
+      if (walkaddr(p->pagetable, a) == 0) uvmfault(p->pagetable, a, 0);
+  }
+}
+
 // Load a program segment into pagetable at virtual address va.
 // va must be page-aligned
 // and the pages from va to va+sz must already be mapped.
@@ -64,6 +64,7 @@ void fileclose(struct file *f) {
   if (ff.type == FD_PIPE) {
     pipeclose(ff.pipe, ff.writable);
   } else if (ff.type == FD_INODE || ff.type == FD_DEVICE) {
+    if (ff.type == FD_INODE && ff.writable) iwriteend(ff.ip);
     begin_op();
     iput(ff.ip);
     end_op();
@@ -93,6 +94,9 @@ int fileread(struct file *f, uint64 addr, int n) {
 
   if (f->readable == 0) return -1;
 
+  // the device and pipe code copy out with spinlocks held.
+  execprefault(addr, n);
+
   if (f->type == FD_PIPE) {
     r = piperead(f->pipe, addr, n);
   } else if (f->type == FD_DEVICE) {
@@ -116,6 +120,9 @@ int filewrite(struct file *f, uint64 addr, int n) {
 
   if (f->writable == 0) return -1;
 
+  // the device and pipe code copy in with spinlocks held.
+  execprefault(addr, n);
+
   if (f->type == FD_PIPE) {
     ret = pipewrite(f->pipe, addr, n);
   } else if (f->type == FD_DEVICE) {
@@ -126,9 +133,11 @@ int filewrite(struct file *f, uint64 addr, int n) {
     // the maximum log transaction size, including
     // i-node, indirect block, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
+    // without LOGDATA the data blocks aren't logged,
+    // and only MAXOPDATA of them limits the size.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE;
+    int max = LOGDATA ? ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE : (MAXOPDATA - 2) * BSIZE;
     int i = 0;
     while (i < n) {
       int n1 = n - i;
@@ -140,8 +149,10 @@ int filewrite(struct file *f, uint64 addr, int n) {
       iunlock(f->ip);
       end_op();
 
-      if (r < 0) break;
-      if (r != n1) panic("short filewrite");
+      if (r != n1) {
+        // error from writei
+        break;
+      }
       i += r;
     }
     ret = (i == n ? n : -1);
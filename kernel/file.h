@@ -18,15 +18,25 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int nexec;          // processes running it; ref's lock guards these two
+  int nwrite;         // open files that can write it
+  struct inode *next; // next inode in its icache hash bucket
+  struct inode *lruprev; // LRU list of unreferenced inodes
+  struct inode *lrunext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
   short type;         // copy of disk inode
+  short flags;        // DI_ flags from the disk inode's type
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  uint nextoff;       // where a sequential read would continue
+  uint raend;         // blocks before this have been read ahead
+  uint bhint;         // the last block allocated to the inode
 };
 
 // map major device number to device functions.
@@ -38,3 +48,4 @@ struct devsw {
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define STATS   2
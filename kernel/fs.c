@@ -35,41 +35,95 @@ static void readsb(int dev, struct superblock *sb) {
   brelse(bp);
 }
 
+static void bsuminit(int dev);
+
 // Init fs
 void fsinit(int dev) {
   readsb(dev, &sb);
   if (sb.magic != FSMAGIC) panic("invalid file system");
   initlog(dev, &sb);
+  bsuminit(dev);
 }
 
 // Zero a block.
-static void bzero(int dev, int bno) {
+static void bzero(int dev, int bno, int data) {
   struct buf *bp;
 
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  if (data)
+    log_order(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-static uint balloc(uint dev) {
-  int b, bi, m;
+// A summary of the free bitmap, kept in memory: the number of
+// free blocks each bitmap block describes, so balloc() needn't
+// read full ones. An entry only changes while its bitmap block's
+// buffer is locked. Blocks a transaction freed count as free,
+// though they can't be reused until it commits.
+static struct {
+  int *nfree;
+  int n;      // number of bitmap blocks
+  uint next;  // where to look for a block when there's no goal
+} bsum;
+
+static void bsuminit(int dev) {
+  struct buf *bp;
+  int i, bi;
+
+  bsum.n = (sb.size + BPB - 1) / BPB;
+  if (bsum.n * sizeof(int) > PGSIZE || (bsum.nfree = (int *)kalloc()) == 0) panic("bsuminit");
+  for (i = 0; i < bsum.n; i++) {
+    bp = bread(dev, sb.bmapstart + i);
+    bsum.nfree[i] = 0;
+    for (bi = 0; bi < BPB && i * BPB + bi < sb.size; bi++) {
+      if ((bp->data[bi / 8] & (1 << (bi % 8))) == 0) bsum.nfree[i]++;
+    }
+    brelse(bp);
+  }
+  bsum.next = 0;
+}
+
+// Allocate a zeroed disk block: the first free one after the
+// inode's last allocation, or else after prev, or else after
+// the last block allocated at all. Nearby blocks are usually
+// in the bitmap block the search starts in, so sequential
+// writes get consecutive blocks. data is 1 if the block will
+// hold file data, which isn't logged; see log_order().
+static uint balloc(struct inode *ip, int data, uint prev) {
+  uint goal, b, bi, m;
+  int i, bb;
   struct buf *bp;
 
-  bp = 0;
-  for (b = 0; b < sb.size; b += BPB) {
-    bp = bread(dev, BBLOCK(b, sb));
-    for (bi = 0; bi < BPB && b + bi < sb.size; bi++) {
+  goal = ip->bhint ? ip->bhint + 1 : prev ? prev + 1 : bsum.next;
+  if (goal >= sb.size) goal = 0;
+
+  // the goal's bitmap block, the others in turn, and then the
+  // goal's again, for the blocks before the goal.
+  for (i = 0; i <= bsum.n; i++) {
+    bb = (goal / BPB + i) % bsum.n;
+    if (bsum.nfree[bb] == 0) continue;
+    bp = bread(ip->dev, sb.bmapstart + bb);
+    for (bi = i == 0 ? goal % BPB : 0; bi < BPB && bb * BPB + bi < sb.size; bi++) {
       m = 1 << (bi % 8);
-      if ((bp->data[bi / 8] & m) == 0) {  // Is block free?
-        bp->data[bi / 8] |= m;            // Mark block in use.
+      if (bi % 8 == 0 && bp->data[bi / 8] == 0xff) {  // skip a full byte
+        bi += 7;
+        continue;
+      }
+      b = bb * BPB + bi;
+      if ((bp->data[bi / 8] & m) == 0 && log_canreuse(b)) {  // Is block free?
+        bp->data[bi / 8] |= m;                               // Mark block in use.
+        bsum.nfree[bb]--;
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        bzero(ip->dev, b, data);
+        ip->bhint = b;
+        bsum.next = b + 1;
+        return b;
       }
     }
     brelse(bp);
@@ -77,6 +131,27 @@ static uint balloc(uint dev) {
   panic("balloc: out of blocks");
 }
 
+// Allocate block b, zeroed, if it is free.
+// Returns 1 if it was, 0 if not.
+static int ballocat(uint dev, uint b, int data) {
+  struct buf *bp;
+  int bi, m, r = 0;
+
+  if (b >= sb.size) return 0;
+  bp = bread(dev, BBLOCK(b, sb));
+  bi = b % BPB;
+  m = 1 << (bi % 8);
+  if ((bp->data[bi / 8] & m) == 0 && log_canreuse(b)) {
+    bp->data[bi / 8] |= m;
+    bsum.nfree[b / BPB]--;
+    log_write(bp);
+    r = 1;
+  }
+  brelse(bp);
+  if (r) bzero(dev, b, data);
+  return r;
+}
+
 // Free a disk block.
 static void bfree(int dev, uint b) {
   struct buf *bp;
@@ -87,8 +162,10 @@ static void bfree(int dev, uint b) {
   m = 1 << (bi % 8);
   if ((bp->data[bi / 8] & m) == 0) panic("freeing free block");
   bp->data[bi / 8] &= ~m;
+  bsum.nfree[b / BPB]++;
   log_write(bp);
   brelse(bp);
+  log_bfree(b);
 }
 
 // Inodes.
@@ -117,7 +194,7 @@ static void bfree(int dev, uint b) {
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
+//   may be recycled if ip->ref is zero. Otherwise ip->ref tracks
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
@@ -127,7 +204,8 @@ static void bfree(int dev, uint b) {
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode and iget() when
+//   it recycles the entry for another inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -151,26 +229,94 @@ static void bfree(int dev, uint b) {
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The cache is a hash table sized at boot to one inode per
+// ICACHEDIV free pages, and no fewer than NINODE. An inode whose
+// ref has fallen to zero stays in its bucket, still valid, until
+// iget() recycles it for another inode, taking the one released
+// longest ago from the head of an LRU list of such inodes.
+//
+// Each hash bucket has a spin-lock. Since ip->ref indicates whether
+// an entry is free, and ip->dev and ip->inum indicate which i-node
+// an entry holds, one must hold the lock of ip's bucket while using
+// any of those fields. icache.lock serializes recycling, so only one
+// CPU at a time moves inodes between buckets. icache.lrulock, taken
+// inside a bucket's lock, protects the LRU list.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum, next, lruprev and lrunext.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
-struct {
+#define IBUCKET(dev, inum) (&icache.bucket[((dev) * 31 + (inum)) % icache.nbucket])
+
+struct ibucket {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *head;  // the bucket's inodes, through next
+  int nhit;            // lookups that found their inode here
+};
+
+struct {
+  struct spinlock lock;  // serializes recycling
+  struct spinlock lrulock;
+  struct inode lru;  // unreferenced inodes, least recently used first
+  struct inode *inode;
+  int ninode;
+  struct ibucket *bucket;
+  int nbucket;
+  int nmiss;   // lookups that had to recycle an inode
+  int nevict;  // recycled inodes that were still valid
 } icache;
 
 void iinit() {
-  int i = 0;
+  struct ibucket *bk;
+  struct inode *ip;
+  uint64 sz;
+  int order;
 
   initlock(&icache.lock, "icache");
-  for (i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
+  initlock(&icache.lrulock, "icache.lru");
+  icache.lru.lruprev = icache.lru.lrunext = &icache.lru;
+
+  icache.ninode = buddy_freepages() / ICACHEDIV;
+  if (icache.ninode < NINODE) icache.ninode = NINODE;
+  icache.nbucket = icache.ninode / 2 + 1;
+  sz = icache.ninode * sizeof(struct inode) + icache.nbucket * sizeof(struct ibucket);
+  for (order = 0; ((uint64)PGSIZE << order) < sz; order++)
+    ;
+  if (order > MAXORDER || (icache.inode = kallocpages(order)) == 0) panic("iinit");
+  icache.bucket = (struct ibucket *)(icache.inode + icache.ninode);
+
+  for (bk = icache.bucket; bk < icache.bucket + icache.nbucket; bk++) {
+    initlock(&bk->lock, "icache.bucket");
+    bk->head = 0;
+    bk->nhit = 0;
+  }
+
+  // Until it is first used, inode i stands for inode i of
+  // (non-existent) device 0, which spreads them over the buckets.
+  for (ip = icache.inode; ip < icache.inode + icache.ninode; ip++) {
+    initsleeplock(&ip->lock, "inode");
+    ip->dev = 0;
+    ip->inum = ip - icache.inode;
+    ip->ref = 0;
+    ip->valid = 0;
+    bk = IBUCKET(ip->dev, ip->inum);
+    ip->next = bk->head;
+    bk->head = ip;
+    ip->lrunext = &icache.lru;
+    ip->lruprev = icache.lru.lruprev;
+    icache.lru.lruprev->lrunext = ip;
+    icache.lru.lruprev = ip;
+  }
+}
+
+// Take a reference to ip, taking it off the LRU list if it
+// had none. Caller must hold ip's bucket lock.
+static void ihold(struct inode *ip) {
+  if (ip->ref++ == 0) {
+    acquire(&icache.lrulock);
+    ip->lruprev->lrunext = ip->lrunext;
+    ip->lrunext->lruprev = ip->lruprev;
+    release(&icache.lrulock);
   }
 }
 
@@ -209,7 +355,7 @@ void iupdate(struct inode *ip) {
 
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
   dip = (struct dinode *)bp->data + ip->inum % IPB;
-  dip->type = ip->type;
+  dip->type = ip->type | ip->flags;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
@@ -219,48 +365,146 @@ void iupdate(struct inode *ip) {
   brelse(bp);
 }
 
+// Find the inode inum on dev in bucket bk, and take a
+// reference to it. Caller must hold bk->lock.
+static struct inode *ilookup(struct ibucket *bk, uint dev, uint inum) {
+  struct inode *ip;
+
+  for (ip = bk->head; ip != 0; ip = ip->next) {
+    if (ip->dev == dev && ip->inum == inum) {
+      ihold(ip);
+      bk->nhit++;
+      return ip;
+    }
+  }
+  return 0;
+}
+
+// Take the unreferenced inode released longest ago out of its
+// bucket, with a reference to it. Caller must hold icache.lock.
+static struct inode *irecycle(void) {
+  struct inode *victim, **pp;
+  struct ibucket *bk;
+
+  for (;;) {
+    acquire(&icache.lrulock);
+    victim = icache.lru.lrunext;
+    release(&icache.lrulock);
+    if (victim == &icache.lru) panic("iget: no inodes");
+
+    bk = IBUCKET(victim->dev, victim->inum);
+    acquire(&bk->lock);
+    if (victim->ref == 0) break;
+    // someone looked it up since we checked; try again.
+    release(&bk->lock);
+  }
+  ihold(victim);
+
+  for (pp = &bk->head; *pp != victim; pp = &(*pp)->next)
+    ;
+  *pp = victim->next;
+  if (victim->valid) icache.nevict++;
+  release(&bk->lock);
+  return victim;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode *iget(uint dev, uint inum) {
-  struct inode *ip, *empty;
-
-  acquire(&icache.lock);
+  struct ibucket *bk = IBUCKET(dev, inum);
+  struct inode *ip;
 
   // Is the inode already cached?
-  empty = 0;
-  for (ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++) {
-    if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
-      ip->ref++;
-      release(&icache.lock);
-      return ip;
-    }
-    if (empty == 0 && ip->ref == 0)  // Remember empty slot.
-      empty = ip;
+  acquire(&bk->lock);
+  ip = ilookup(bk, dev, inum);
+  release(&bk->lock);
+  if (ip) return ip;
+
+  // Not cached. Check again under icache.lock, in case
+  // another CPU just cached it.
+  acquire(&icache.lock);
+  acquire(&bk->lock);
+  ip = ilookup(bk, dev, inum);
+  release(&bk->lock);
+  if (ip) {
+    release(&icache.lock);
+    return ip;
   }
 
-  // Recycle an inode cache entry.
-  if (empty == 0) panic("iget: no inodes");
+  ip = irecycle();
+  icache.nmiss++;
 
-  ip = empty;
+  acquire(&bk->lock);
   ip->dev = dev;
   ip->inum = inum;
-  ip->ref = 1;
   ip->valid = 0;
+  ip->next = bk->head;
+  bk->head = ip;
+  release(&bk->lock);
   release(&icache.lock);
-
   return ip;
 }
 
 // Increment reference count for ip.
 // Returns ip to enable ip = idup(ip1) idiom.
 struct inode *idup(struct inode *ip) {
-  acquire(&icache.lock);
+  struct ibucket *bk = IBUCKET(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&icache.lock);
+  release(&bk->lock);
   return ip;
 }
 
+// Count a process running ip. uvmfault() reads the program's
+// pages from ip long after exec, so ip must not change while
+// any process runs it: fails if ip is open for writing.
+int iexecbegin(struct inode *ip) {
+  struct ibucket *bk = IBUCKET(ip->dev, ip->inum);
+  int r = -1;
+
+  acquire(&bk->lock);
+  if (ip->nwrite == 0) {
+    ip->nexec++;
+    r = 0;
+  }
+  release(&bk->lock);
+  return r;
+}
+
+void iexecend(struct inode *ip) {
+  struct ibucket *bk = IBUCKET(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
+  if (ip->nexec < 1) panic("iexecend");
+  ip->nexec--;
+  release(&bk->lock);
+}
+
+// Count an open of ip for writing; fails while ip is being run.
+int iwritebegin(struct inode *ip) {
+  struct ibucket *bk = IBUCKET(ip->dev, ip->inum);
+  int r = -1;
+
+  acquire(&bk->lock);
+  if (ip->nexec == 0) {
+    ip->nwrite++;
+    r = 0;
+  }
+  release(&bk->lock);
+  return r;
+}
+
+void iwriteend(struct inode *ip) {
+  struct ibucket *bk = IBUCKET(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
+  if (ip->nwrite < 1) panic("iwriteend");
+  ip->nwrite--;
+  release(&bk->lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void ilock(struct inode *ip) {
@@ -274,13 +518,17 @@ void ilock(struct inode *ip) {
   if (ip->valid == 0) {
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
     dip = (struct dinode *)bp->data + ip->inum % IPB;
-    ip->type = dip->type;
+    ip->type = dip->type & DI_TYPE;
+    ip->flags = dip->type & ~DI_TYPE;
     ip->major = dip->major;
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->nextoff = 0;
+    ip->raend = 0;
+    ip->bhint = 0;
     ip->valid = 1;
     if (ip->type == 0) panic("ilock: no type");
   }
@@ -301,7 +549,9 @@ void iunlock(struct inode *ip) {
 // All calls to iput() must be inside a transaction in
 // case it has to free the inode.
 void iput(struct inode *ip) {
-  acquire(&icache.lock);
+  struct ibucket *bk = IBUCKET(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
 
   if (ip->ref == 1 && ip->valid && ip->nlink == 0) {
     // inode has no links and no other references: truncate and free.
@@ -310,20 +560,46 @@ void iput(struct inode *ip) {
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&icache.lock);
+    release(&bk->lock);
 
     itrunc(ip);
+    if (ip->type == T_DIR) dcpurge(ip->dev, ip->inum);
     ip->type = 0;
+    ip->flags = 0;
     iupdate(ip);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
 
-    acquire(&icache.lock);
+    acquire(&bk->lock);
   }
 
-  ip->ref--;
-  release(&icache.lock);
+  if (--ip->ref == 0) {
+    // the entry can be recycled now; put it at the tail of the LRU list.
+    acquire(&icache.lrulock);
+    ip->lrunext = &icache.lru;
+    ip->lruprev = icache.lru.lruprev;
+    icache.lru.lruprev->lrunext = ip;
+    icache.lru.lruprev = ip;
+    release(&icache.lrulock);
+  }
+  release(&bk->lock);
+}
+
+// Format the cache's counters into buf, for the statistics device.
+int icachestats(char *buf, int sz) {
+  int n, nhit = 0, nacq = 0, ntas = 0;
+
+  for (struct ibucket *bk = icache.bucket; bk < icache.bucket + icache.nbucket; bk++) {
+    nhit += bk->nhit;
+    nacq += bk->lock.n;
+    ntas += bk->lock.nts;
+  }
+  n = snprintf(buf, sz, "icache: inodes %d hit %d miss %d evict %d\n", icache.ninode, nhit, icache.nmiss,
+               icache.nevict);
+  n += snprintf(buf + n, sz - n, "icache: #acquire() %d #test-and-set %d recycle #acquire() %d #test-and-set %d\n",
+                nacq, ntas, icache.lock.n, icache.lock.nts);
+  return n;
 }
 
 // Common idiom: unlock, then put.
@@ -337,62 +613,120 @@ void iunlockput(struct inode *ip) {
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], and the NDINDIRECT
+// after those in the blocks listed in block ip->addrs[NDIRECT+1].
+//
+// If ip->flags has DI_EXTENT, ip->addrs[] instead holds up to
+// NEXTENT runs of consecutive blocks, as pairs of first block
+// and length, so that mapping a block never reads the disk.
+
+// Return entry i of indirect block addr, allocating a block
+// for it if there is none. data is as for balloc().
+static uint iblock(struct inode *ip, uint addr, uint i, int data) {
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  a = (uint *)bp->data;
+  if ((addr = a[i]) == 0) {
+    a[i] = addr = balloc(ip, data, i > 0 ? a[i - 1] : 0);
+    log_write(bp);
+  }
+  brelse(bp);
+  return addr;
+}
+
+// bmap() for an inode mapped by extents. Files have no holes,
+// so a block that isn't mapped yet follows the last extent:
+// extend that if the next disk block is free, or else start
+// another. Returns 0 if ip has used all its extents.
+static uint emap(struct inode *ip, uint bn) {
+  uint *e = ip->addrs;
+  int i;
+
+  for (i = 0; i < NEXTENT && e[2 * i + 1] != 0; i++) {
+    if (bn < e[2 * i + 1]) return e[2 * i] + bn;
+    bn -= e[2 * i + 1];
+  }
+  if (bn != 0) panic("emap: hole");
+  if (i > 0 && ballocat(ip->dev, e[2 * i - 2] + e[2 * i - 1], 1)) return e[2 * i - 2] + e[2 * i - 1]++;
+  if (i == NEXTENT) return 0;
+  e[2 * i] = balloc(ip, 1, i > 0 ? e[2 * i - 2] + e[2 * i - 1] - 1 : 0);
+  e[2 * i + 1] = 1;
+  return e[2 * i];
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
+// Returns 0 if ip has no room for the block.
 static uint bmap(struct inode *ip, uint bn) {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr;
+  int data = ip->type != T_DIR;
+
+  if (ip->flags & DI_EXTENT) return emap(ip, bn);
 
   if (bn < NDIRECT) {
-    if ((addr = ip->addrs[bn]) == 0) ip->addrs[bn] = addr = balloc(ip->dev);
+    if ((addr = ip->addrs[bn]) == 0) ip->addrs[bn] = addr = balloc(ip, data, bn > 0 ? ip->addrs[bn - 1] : 0);
     return addr;
   }
   bn -= NDIRECT;
 
   if (bn < NINDIRECT) {
     // Load indirect block, allocating if necessary.
-    if ((addr = ip->addrs[NDIRECT]) == 0) ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint *)bp->data;
-    if ((addr = a[bn]) == 0) {
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+    if ((addr = ip->addrs[NDIRECT]) == 0) ip->addrs[NDIRECT] = addr = balloc(ip, 0, ip->addrs[NDIRECT - 1]);
+    return iblock(ip, addr, bn, data);
+  }
+  bn -= NINDIRECT;
+
+  if (bn < NDINDIRECT) {
+    // Load doubly-indirect block, then the indirect block it lists.
+    if ((addr = ip->addrs[NDIRECT + 1]) == 0) ip->addrs[NDIRECT + 1] = addr = balloc(ip, 0, 0);
+    addr = iblock(ip, addr, bn / NINDIRECT, 0);
+    return iblock(ip, addr, bn % NINDIRECT, data);
   }
 
   panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void itrunc(struct inode *ip) {
-  int i, j;
+// Free block addr and, if it is an indirect block
+// depth levels above the data, the blocks it lists.
+static void bfreetree(uint dev, uint addr, int depth) {
   struct buf *bp;
   uint *a;
+  int j;
 
-  for (i = 0; i < NDIRECT; i++) {
-    if (ip->addrs[i]) {
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
-  }
-
-  if (ip->addrs[NDIRECT]) {
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  if (depth > 0) {
+    bp = bread(dev, addr);
     a = (uint *)bp->data;
     for (j = 0; j < NINDIRECT; j++) {
-      if (a[j]) bfree(ip->dev, a[j]);
+      if (a[j]) bfreetree(dev, a[j], depth - 1);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  bfree(dev, addr);
+}
+
+// Truncate inode (discard contents).
+// Caller must hold ip->lock.
+void itrunc(struct inode *ip) {
+  uint i, j;
+
+  if (ip->flags & DI_EXTENT) {
+    for (i = 0; i < NEXTENT; i++) {
+      for (j = 0; j < ip->addrs[2 * i + 1]; j++) bfree(ip->dev, ip->addrs[2 * i] + j);
+    }
+  } else {
+    for (i = 0; i < NDIRECT; i++) {
+      if (ip->addrs[i]) bfree(ip->dev, ip->addrs[i]);
+    }
+    if (ip->addrs[NDIRECT]) bfreetree(ip->dev, ip->addrs[NDIRECT], 1);
+    if (ip->addrs[NDIRECT + 1]) bfreetree(ip->dev, ip->addrs[NDIRECT + 1], 2);
+  }
+  memset(ip->addrs, 0, sizeof(ip->addrs));
 
   ip->size = 0;
+  ip->raend = 0;
+  ip->bhint = 0;
   iupdate(ip);
 }
 
@@ -406,6 +740,20 @@ void stati(struct inode *ip, struct stat *st) {
   st->size = ip->size;
 }
 
+// Start reading up to NREADAHEAD of ip's blocks from bn on,
+// skipping those an earlier call already started.
+// Caller must hold ip->lock.
+static void readahead(struct inode *ip, uint bn) {
+  uint end = min(bn + NREADAHEAD, (ip->size + BSIZE - 1) / BSIZE);
+  uint blockno[NREADAHEAD];
+  int n = 0;
+
+  if (bn < ip->raend) bn = ip->raend;
+  for (; bn < end; bn++) blockno[n++] = bmap(ip, bn);
+  if (n > 0) breadahead(ip->dev, blockno, n);
+  if (end > ip->raend) ip->raend = end;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -417,6 +765,13 @@ int readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n) {
   if (off > ip->size || off + n < off) return 0;
   if (off + n > ip->size) n = ip->size - off;
 
+  // Reading on from where the last read stopped?
+  // Then start reading the next blocks before they're asked for.
+  if (off == ip->nextoff && n > 0)
+    readahead(ip, (off + n - 1) / BSIZE + 1);
+  else
+    ip->raend = 0;
+
   for (tot = 0; tot < n; tot += m, off += m, dst += m) {
     bp = bread(ip->dev, bmap(ip, off / BSIZE));
     m = min(n - tot, BSIZE - off % BSIZE);
@@ -426,6 +781,7 @@ int readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n) {
     }
     brelse(bp);
   }
+  ip->nextoff = off;
   return tot;
 }
 
@@ -434,20 +790,25 @@ int readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n) {
 // If user_src==1, then src is a user virtual address;
 // otherwise, src is a kernel address.
 int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
 
   if (off > ip->size || off + n < off) return -1;
   if (off + n > MAXFILE * BSIZE) return -1;
 
   for (tot = 0; tot < n; tot += m, off += m, src += m) {
-    bp = bread(ip->dev, bmap(ip, off / BSIZE));
+    if ((addr = bmap(ip, off / BSIZE)) == 0) break;
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off % BSIZE);
     if (either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
-    log_write(bp);
+    // a directory's contents are metadata.
+    if (ip->type == T_DIR)
+      log_write(bp);
+    else
+      log_order(bp);
     brelse(bp);
   }
 
@@ -459,13 +820,187 @@ int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
     iupdate(ip);
   }
 
-  return n;
+  return tot;
 }
 
 // Directories
 
 int namecmp(const char *s, const char *t) { return strncmp(s, t, DIRSIZ); }
 
+// Hashed directories; see struct dirindex in fs.h.
+// Each block the index lists holds the names whose hash is at
+// least its entry's, and less than the next entry's. A block
+// that fills up is split in two, by hash, into a new block at
+// the end of the directory.
+
+// Hash a name. mkfs has a copy.
+static uint dirhash(char *name) {
+  uint h = 2166136261;
+
+  for (int i = 0; i < DIRSIZ && name[i]; i++) h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Entry i of the index in block 0 of a hashed directory.
+#define DIRINDEX(bp, i) (&((struct dirindex *)(bp)->data)[2 + (i) / 2])
+#define DIHASH(bp, i) (DIRINDEX(bp, i)->hash[(i) % 2])
+#define DIBLK(bp, i) (DIRINDEX(bp, i)->blk[(i) % 2])
+
+// Return the position in index ib of the block for names with
+// hash h, and set *n to the number of blocks ib lists.
+static int dirfind(struct buf *ib, uint h, int *n) {
+  int i, k = 0;
+
+  for (i = 0; i < NDIRINDEX && DIBLK(ib, i) != 0; i++) {
+    if (DIHASH(ib, i) <= h) k = i;
+  }
+  *n = i;
+  return k;
+}
+
+// dirlookup() for a hashed directory: return the inode number
+// name refers to in dp, and set *poff; or return 0.
+static uint hdirlookup(struct inode *dp, char *name, uint *poff) {
+  struct buf *bp;
+  struct dirent *de;
+  uint blk, inum = 0;
+  int i, n;
+
+  if (dp->size == 0) return 0;
+  bp = bread(dp->dev, bmap(dp, 0));
+  if (namecmp(name, ".") == 0 || namecmp(name, "..") == 0) {
+    i = name[1] == '.';
+    de = (struct dirent *)bp->data + i;
+    if (de->inum != 0 && namecmp(name, de->name) == 0) {
+      inum = de->inum;
+      *poff = i * sizeof(*de);
+    }
+    brelse(bp);
+    return inum;
+  }
+  blk = DIBLK(bp, dirfind(bp, dirhash(name), &n));
+  brelse(bp);
+
+  bp = bread(dp->dev, bmap(dp, blk));
+  for (i = 0, de = (struct dirent *)bp->data; i < DIRPB; i++, de++) {
+    if (de->inum != 0 && namecmp(name, de->name) == 0) {
+      inum = de->inum;
+      *poff = blk * BSIZE + i * sizeof(*de);
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
+// Split block bp of hashed directory dp, which is full and at
+// position k of the n in index ib: move the entries with the
+// larger hashes to a new block. Returns -1 if it can't.
+static int hdirsplit(struct inode *dp, struct buf *ib, int k, int n, struct buf *bp) {
+  struct dirent *de = (struct dirent *)bp->data, *nde;
+  uint h[DIRPB], m, nblk;
+  struct buf *nb;
+  int i, j, mi, nless;
+
+  if (n == NDIRINDEX) return -1;
+
+  // split at the median hash, or as near it as duplicates allow.
+  // The new block gets the entries with hashes from h[mi] up, so
+  // h[mi] must not be the smallest.
+  for (i = 0; i < DIRPB; i++) h[i] = dirhash(de[i].name);
+  mi = -1;
+  for (i = 0; i < DIRPB; i++) {
+    for (j = 0, nless = 0; j < DIRPB; j++) nless += h[j] < h[i];
+    if (nless > 0 && (mi < 0 || (nless <= DIRPB / 2 ? h[i] > h[mi] : h[i] < h[mi]))) mi = i;
+  }
+  if (mi < 0) return -1;  // all the same hash
+  m = h[mi];
+
+  nblk = dp->size / BSIZE;
+  nb = bread(dp->dev, bmap(dp, nblk));
+  dp->size += BSIZE;
+  iupdate(dp);
+  nde = (struct dirent *)nb->data;
+  for (i = 0, j = 0; i < DIRPB; i++) {
+    if (h[i] >= m) {
+      nde[j] = de[i];
+      memset(&de[i], 0, sizeof(de[i]));
+      dcenter(dp, nde[j].name, nde[j].inum, nblk * BSIZE + j * sizeof(*de));
+      j++;
+    }
+  }
+  log_write(nb);
+  brelse(nb);
+  log_write(bp);
+
+  for (i = n; i > k + 1; i--) {
+    DIHASH(ib, i) = DIHASH(ib, i - 1);
+    DIBLK(ib, i) = DIBLK(ib, i - 1);
+  }
+  DIHASH(ib, k + 1) = m;
+  DIBLK(ib, k + 1) = nblk;
+  log_write(ib);
+  return 0;
+}
+
+// dirlink() for a hashed directory.
+// Returns -1 if the directory is full.
+static int hdirlink(struct inode *dp, char *name, uint inum) {
+  struct buf *ib, *bp;
+  struct dirent *de;
+  uint h, blk;
+  int i, k, n, r;
+
+  if (dp->size == 0) {
+    // a new directory: an index listing block 1 for all hashes.
+    ib = bread(dp->dev, bmap(dp, 0));
+    DIHASH(ib, 0) = 0;
+    DIBLK(ib, 0) = 1;
+    log_write(ib);
+    brelse(ib);
+    bmap(dp, 1);
+    dp->size = 2 * BSIZE;
+    iupdate(dp);
+  }
+
+  ib = bread(dp->dev, bmap(dp, 0));
+  if (namecmp(name, ".") == 0 || namecmp(name, "..") == 0) {
+    i = name[1] == '.';
+    de = (struct dirent *)ib->data + i;
+    strncpy(de->name, name, DIRSIZ);
+    de->inum = inum;
+    log_write(ib);
+    brelse(ib);
+    dcenter(dp, name, inum, i * sizeof(*de));
+    return 0;
+  }
+
+  h = dirhash(name);
+  for (;;) {
+    k = dirfind(ib, h, &n);
+    blk = DIBLK(ib, k);
+    bp = bread(dp->dev, bmap(dp, blk));
+    for (i = 0, de = (struct dirent *)bp->data; i < DIRPB; i++, de++) {
+      if (de->inum == 0) break;
+    }
+    if (i < DIRPB) {
+      strncpy(de->name, name, DIRSIZ);
+      de->inum = inum;
+      log_write(bp);
+      brelse(bp);
+      brelse(ib);
+      dcenter(dp, name, inum, blk * BSIZE + i * sizeof(*de));
+      return 0;
+    }
+    r = hdirsplit(dp, ib, k, n, bp);
+    brelse(bp);
+    if (r < 0) {
+      brelse(ib);
+      return -1;
+    }
+  }
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode *dirlookup(struct inode *dp, char *name, uint *poff) {
@@ -474,6 +1009,20 @@ struct inode *dirlookup(struct inode *dp, char *name, uint *poff) {
 
   if (dp->type != T_DIR) panic("dirlookup not DIR");
 
+  if (dclookup(dp, name, &inum, &off)) {
+    if (inum == 0) return 0;
+    if (poff) *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  if (dp->flags & DI_HASHED) {
+    inum = hdirlookup(dp, name, &off);
+    dcenter(dp, name, inum, inum ? off : 0);
+    if (inum == 0) return 0;
+    if (poff) *poff = off;
+    return iget(dp->dev, inum);
+  }
+
   for (off = 0; off < dp->size; off += sizeof(de)) {
     if (readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) panic("dirlookup read");
     if (de.inum == 0) continue;
@@ -481,10 +1030,12 @@ struct inode *dirlookup(struct inode *dp, char *name, uint *poff) {
       // entry matches path element
       if (poff) *poff = off;
       inum = de.inum;
+      dcenter(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -500,6 +1051,8 @@ int dirlink(struct inode *dp, char *name, uint inum) {
     return -1;
   }
 
+  if (dp->flags & DI_HASHED) return hdirlink(dp, name, inum);
+
   // Look for an empty dirent.
   for (off = 0; off < dp->size; off += sizeof(de)) {
     if (readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) panic("dirlink read");
@@ -509,6 +1062,7 @@ int dirlink(struct inode *dp, char *name, uint inum) {
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if (writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) panic("dirlink");
+  dcenter(dp, name, inum, off);
 
   return 0;
 }
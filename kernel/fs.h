@@ -24,18 +24,30 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
+
+// A file's addrs[] holds NDIRECT direct blocks, an indirect block
+// and a doubly-indirect block; or, if DI_EXTENT is set, up to
+// NEXTENT extents, each a pair of start block and length.
+#define NEXTENT ((NDIRECT + 2) / 2)
+
+// dinode.type holds the file type in its low byte,
+// and flags above it.
+#define DI_TYPE   0xff
+#define DI_EXTENT 0x100  // addrs[] lists extents
+#define DI_HASHED 0x200  // a directory indexed by hash of name
 
 // On-disk inode structure
 struct dinode {
-  short type;           // File type
+  short type;           // File type, and DI_ flags
   short major;          // Major device number (T_DEVICE only)
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses, or extents
 };
 
 // Inodes per block.
@@ -58,3 +70,21 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Directory entries per block.
+#define DIRPB (BSIZE / sizeof(struct dirent))
+
+// A DI_HASHED directory keeps "." and ".." in the first two
+// entries of block 0, as usual, and fills the rest of block 0
+// with an index of the blocks holding its other entries: which
+// block holds names whose hash is in which range. The index is
+// made of entries with inum 0, which readers of the directory
+// skip.
+#define NDIRINDEX (2 * (DIRPB - 2))  // blocks the index can list
+
+struct dirindex {
+  ushort inum;    // always 0
+  ushort blk[2];  // block of the directory; 0 if unused
+  ushort pad;
+  uint hash[2];   // smallest hash the block holds
+};
+
@@ -1,6 +1,24 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU keeps its own cache of free pages, so kalloc() and
+// kfree() normally take only a lock that no other CPU touches.
+// A CPU whose cache runs dry refills it with a batch of pages
+// from the buddy allocator (buddy.c), or if that is empty too,
+// steals half of another CPU's cache. A cache that grows too
+// large gives a batch back.
+//
+// kallocpages() hands out physically contiguous runs of
+// 2^order pages straight from the buddy allocator.
+//
+// Idle CPUs keep a small pool of already-zeroed pages, so that
+// kzalloc() can usually hand out a zeroed page without paying
+// for the memset on the caller's critical path.
+//
+// Every single page carries a reference count, so that
+// copy-on-write fork can share a page between page tables;
+// kfree() only frees a page when its last reference goes.
 
 #include "types.h"
 #include "param.h"
@@ -9,7 +27,10 @@
 #include "riscv.h"
 #include "defs.h"
 
-void freerange(void *pa_start, void *pa_end);
+#define KBATCH 32               // pages moved to or from buddy.c at once
+#define KCACHEMAX (2 * KBATCH)  // give a batch back above this many
+#define NZERO 128               // pre-zeroed pages to keep for kzalloc()
+#define REF(pa) (kref[((uint64)(pa) - KERNBASE) / PGSIZE])
 
 extern char end[];  // first address after kernel.
                     // defined by kernel.ld.
@@ -18,53 +39,309 @@ struct run {
   struct run *next;
 };
 
-struct {
+// A CPU's private cache of free pages.
+struct kcache {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;
+  int nrefill;  // refills taken from buddy.c
+  int nsteal;   // refills stolen from another CPU
+  int ndrain;   // batches given back to buddy.c
+};
+
+struct {
+  struct kcache cpu[NCPU];
 } kmem;
 
+// Pages zeroed by idle CPUs, waiting for kzalloc().
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+  int nhit;   // kzalloc()s served from the pool
+  int nmiss;  // kzalloc()s that had to zero a page
+} kzero;
+
+// References to each page handed out by kalloc().
+int kref[(PHYSTOP - KERNBASE) / PGSIZE];
+
 void kinit() {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void *)PHYSTOP);
+  for (int i = 0; i < NCPU; i++) initlock(&kmem.cpu[i].lock, "kcache");
+  initlock(&kzero.lock, "kzero");
+  buddyinit(end, (void *)PHYSTOP);
+}
+
+// Fill n bytes at pa with c, to catch dangling refs and uses
+// of uninitialized memory. Building with KALLOC_FAST=1 skips
+// this, since it writes every page twice per allocation.
+static void junk(void *pa, int c, uint64 n) {
+#ifndef KALLOC_FAST
+  memset(pa, c, n);
+#endif
 }
 
-void freerange(void *pa_start, void *pa_end) {
-  char *p;
-  p = (char *)PGROUNDUP((uint64)pa_start);
-  for (; p + PGSIZE <= (char *)pa_end; p += PGSIZE) kfree(p);
+// Detach up to n pages from the front of *list.
+// Returns the detached chain; *cnt is set to its length.
+static struct run *ktake(struct run **list, int n, int *cnt) {
+  struct run *head, *r;
+  int i;
+
+  head = r = *list;
+  if (r == 0) {
+    *cnt = 0;
+    return 0;
+  }
+  for (i = 1; i < n && r->next; i++) r = r->next;
+  *list = r->next;
+  r->next = 0;
+  *cnt = i;
+  return head;
+}
+
+// Find a batch of free pages for CPU id, whose cache is empty.
+// Must not be called with any kmem lock held, since it
+// takes other CPUs' cache locks.
+static struct run *kgrab(int id, int *cnt) {
+  struct kcache *kc = &kmem.cpu[id];
+  struct run *r;
+  void *pa[KBATCH];
+  int i, n;
+
+  if ((n = buddy_allocv(pa, KBATCH)) > 0) {
+    for (i = 0; i < n; i++) ((struct run *)pa[i])->next = i + 1 < n ? pa[i + 1] : 0;
+    kc->nrefill++;
+    *cnt = n;
+    return pa[0];
+  }
+
+  // buddy.c is empty; steal half of some other CPU's cache.
+  for (i = 1; i < NCPU; i++) {
+    struct kcache *victim = &kmem.cpu[(id + i) % NCPU];
+    acquire(&victim->lock);
+    r = ktake(&victim->freelist, (victim->nfree + 1) / 2, cnt);
+    victim->nfree -= *cnt;
+    release(&victim->lock);
+    if (r) {
+      kc->nsteal++;
+      return r;
+    }
+  }
+  return 0;
+}
+
+// Give the pages on chain r back to buddy.c.
+static void kreturn(struct run *r) {
+  void *pa[KBATCH];
+  int n;
+
+  while (r) {
+    for (n = 0; r && n < KBATCH; r = r->next) pa[n++] = r;
+    buddy_freev(pa, n);
+  }
 }
 
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc().
 void kfree(void *pa) {
-  struct run *r;
+  struct run *r, *batch;
+  struct kcache *kc;
+  int n;
 
   if (((uint64)pa % PGSIZE) != 0 || (char *)pa < end || (uint64)pa >= PHYSTOP) panic("kfree");
 
+  // Still in use by another page table.
+  if ((n = __sync_sub_and_fetch(&REF(pa), 1)) > 0) return;
+  if (n < 0) panic("kfree: ref");
+
   // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  junk(pa, 1, PGSIZE);
 
   r = (struct run *)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  kc = &kmem.cpu[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->nfree++;
+  batch = 0;
+  if (kc->nfree > KCACHEMAX) {
+    batch = ktake(&kc->freelist, KBATCH, &n);
+    kc->nfree -= n;
+    kc->ndrain++;
+  }
+  release(&kc->lock);
+  pop_off();
+
+  if (batch) kreturn(batch);
+}
+
+// Take a page from the pre-zeroed pool, or return 0.
+// The page's first word held the list link; the rest is zero.
+static struct run *kzerotake(void) {
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  if (r) {
+    kzero.freelist = r->next;
+    kzero.nfree--;
+  }
+  release(&kzero.lock);
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
 void *kalloc(void) {
-  struct run *r;
+  struct run *r, *batch;
+  struct kcache *kc;
+  int id, n;
+
+  push_off();
+  id = cpuid();
+  kc = &kmem.cpu[id];
+  acquire(&kc->lock);
+  r = kc->freelist;
+  if (r == 0) {
+    // kgrab() takes other CPUs' locks, so drop ours first;
+    // interrupts stay off, so we remain on this CPU.
+    release(&kc->lock);
+    batch = kgrab(id, &n);
+    acquire(&kc->lock);
+    if (batch) {
+      for (r = batch; r->next; r = r->next)
+        ;
+      r->next = kc->freelist;
+      kc->freelist = batch;
+      kc->nfree += n;
+    }
+    r = kc->freelist;
+  }
+  if (r) {
+    kc->freelist = r->next;
+    kc->nfree--;
+  }
+  release(&kc->lock);
+  pop_off();
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if (r) kmem.freelist = r->next;
-  release(&kmem.lock);
+  // Out of memory but for the zeroed pool; use it.
+  if (r == 0) r = kzerotake();
 
-  if (r) memset((char *)r, 5, PGSIZE);  // fill with junk
+  if (r) {
+    REF(r) = 1;
+    junk((char *)r, 5, PGSIZE);  // fill with junk
+  }
   return (void *)r;
 }
+
+// Allocate one zeroed page of physical memory.
+// Returns 0 if the memory cannot be allocated.
+void *kzalloc(void) {
+  struct run *r;
+
+  if ((r = kzerotake()) != 0) {
+    r->next = 0;
+    __sync_fetch_and_add(&kzero.nhit, 1);
+    return (void *)r;
+  }
+  __sync_fetch_and_add(&kzero.nmiss, 1);
+  if ((r = kalloc()) != 0) memset(r, 0, PGSIZE);
+  return (void *)r;
+}
+
+// Add a reference to a page returned by kalloc(),
+// which will then take one more kfree() to free.
+void kdup(void *pa) {
+  if (((uint64)pa % PGSIZE) != 0 || (char *)pa < end || (uint64)pa >= PHYSTOP) panic("kdup");
+  __sync_fetch_and_add(&REF(pa), 1);
+}
+
+// Return the number of references to a page returned by kalloc().
+int krefcnt(void *pa) { return REF(pa); }
+
+// Called by the scheduler on an idle CPU: zero one page for
+// kzalloc() if the pool is short. Returns 1 if it did any work,
+// 0 if the CPU may go to sleep.
+int kzeroidle(void) {
+  struct run *r;
+
+  if (kzero.nfree >= NZERO) return 0;
+  if ((r = kalloc()) == 0) return 0;
+  memset(r, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  r->next = kzero.freelist;
+  kzero.freelist = r;
+  kzero.nfree++;
+  release(&kzero.lock);
+  return 1;
+}
+
+// Empty every CPU's cache and the zeroed pool back into buddy.c,
+// so that cached single pages no longer keep their neighbours
+// from merging.
+static void kdrainall(void) {
+  struct kcache *kc;
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  kzero.freelist = 0;
+  kzero.nfree = 0;
+  release(&kzero.lock);
+  kreturn(r);
+
+  for (kc = kmem.cpu; kc < &kmem.cpu[NCPU]; kc++) {
+    acquire(&kc->lock);
+    r = kc->freelist;
+    kc->freelist = 0;
+    kc->nfree = 0;
+    release(&kc->lock);
+    kreturn(r);
+  }
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Returns 0 if the memory cannot be allocated.
+void *kallocpages(int order) {
+  void *pa;
+
+  if (order == 0) return kalloc();
+  if ((pa = buddy_alloc(order)) == 0) {
+    kdrainall();
+    if ((pa = buddy_alloc(order)) == 0) return 0;
+  }
+  junk(pa, 5, (uint64)PGSIZE << order);  // fill with junk
+  return pa;
+}
+
+// Free pages returned by kallocpages(order).
+void kfreepages(void *pa, int order) {
+  if (order == 0) {
+    kfree(pa);
+    return;
+  }
+  if ((char *)pa < end || (uint64)pa + ((uint64)PGSIZE << order) > PHYSTOP) panic("kfreepages");
+
+  // Fill with junk to catch dangling refs.
+  junk(pa, 1, (uint64)PGSIZE << order);
+  buddy_free(pa, order);
+}
+
+// Format the allocator's counters into buf, for the statistics device.
+int kallocstats(char *buf, int sz) {
+  int n;
+
+  n = buddystats(buf, sz);
+  n += snprintf(buf + n, sz - n, "kzero: pool %d hit %d miss %d\n", kzero.nfree, kzero.nhit, kzero.nmiss);
+  for (int i = 0; i < NCPU; i++) {
+    struct kcache *kc = &kmem.cpu[i];
+    if (kc->lock.n == 0) continue;
+    n += snprintf(buf + n, sz - n, "kmem: cpu %d free %d #acquire() %d #test-and-set %d refill %d steal %d drain %d\n",
+                  i, kc->nfree, kc->lock.n, kc->lock.nts, kc->nrefill, kc->nsteal, kc->ndrain);
+  }
+  return n;
+}
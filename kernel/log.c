@@ -21,6 +21,14 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// The last end_op() of a transaction that more than one system
+// call joined expects more to follow, so before committing it
+// waits for up to GROUPTICKS for other processes to begin
+// operations and join the same transaction. It commits once some
+// have joined and all have ended, when the time is up, or when
+// the log has no room for another operation. Several processes'
+// system calls thus share one commit.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -28,13 +36,24 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A commit queues all of its log writes at once, and waits
+// for them before writing the header. mkfs chooses the size
+// of the log, up to LOGMAX blocks.
+//
+// Unless LOGDATA is set, only metadata goes through the log.
+// A write of file data records the block with log_order(), and
+// commit() writes it in place, together with the log blocks and
+// before the header, so that a committed inode never points to
+// data that didn't reach the disk. Blocks freed by a transaction
+// aren't reused until it commits, since writing one in place
+// would overwrite a block that the old, committed state of the
+// file system may still be using.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[LOGMAX];
 };
 
 struct log {
@@ -43,8 +62,24 @@ struct log {
   int size;
   int outstanding;  // how many FS sys calls are executing.
   int committing;   // in commit(), please wait.
+  int gathering;    // an end_op() is waiting for others to join before committing.
+  int nops;         // FS sys calls in the current transaction.
   int dev;
   struct logheader lh;
+
+  int data[NLOGDATA];  // file data blocks to write in place before the commit
+  int ndata;
+  uchar *freed;  // bitmap of blocks freed by the current transaction
+  int nfreed;
+  int nbits;
+  struct buf *bufs[LOGMAX + NLOGDATA];  // the blocks commit() is writing
+
+  int ncommit;  // statistics
+  int nopstot;
+  int ngather;   // commits that waited for others to join
+  int maxops;    // most FS sys calls in one commit
+  int nblocks;
+  int ndatatot;
 };
 struct log log;
 
@@ -58,21 +93,37 @@ void initlog(int dev, struct superblock *sb) {
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  if (log.size < 2 || log.size > LOGMAX + 1) panic("initlog: log size");
+  if (!LOGDATA) {
+    int order;
+    log.nbits = sb->size;
+    for (order = 0; ((uint64)PGSIZE << order) < (log.nbits + 7) / 8; order++)
+      ;
+    if ((log.freed = kallocpages(order)) == 0) panic("initlog");
+    memset(log.freed, 0, (log.nbits + 7) / 8);
+  }
   recover_from_log();
 }
 
 // Copy committed blocks from log to their home location
+// Start all the writes, then wait for them, so the disk has
+// the whole transaction queued at once, and neighbouring
+// blocks go in the same operation.
 static void install_trans(void) {
+  struct buf **dbuf = log.bufs;
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
     struct buf *lbuf = bread(log.dev, log.start + tail + 1);  // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]);    // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);                   // copy block to dst
-    bwrite(dbuf);                                             // write dst to disk
-    bunpin(dbuf);
+    dbuf[tail] = bread(log.dev, log.lh.block[tail]);          // read dst
+    memmove(dbuf[tail]->data, lbuf->data, BSIZE);             // copy block to dst
     brelse(lbuf);
-    brelse(dbuf);
+  }
+  bwritestart(dbuf, log.lh.n);  // write dsts to disk
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(dbuf[tail]);
+    bunpin(dbuf[tail]);
+    brelse(dbuf[tail]);
   }
 }
 
@@ -110,43 +161,82 @@ static void recover_from_log(void) {
   write_head();  // clear the log
 }
 
+// Can another FS system call join the current transaction?
+// Caller holds log.lock.
+static int logroom(void) {
+  return log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS <= log.size - 1 &&
+         log.ndata + (log.outstanding + 1) * MAXOPDATA <= NLOGDATA;
+}
+
 // called at the start of each FS system call.
 void begin_op(void) {
   acquire(&log.lock);
   while (1) {
     if (log.committing) {
       sleep(&log, &log.lock);
-    } else if (log.lh.n + (log.outstanding + 1) * MAXOPBLOCKS > LOGSIZE) {
+    } else if (!logroom()) {
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.nops += 1;
       release(&log.lock);
       break;
     }
   }
 }
 
+// Called by clockintr() on every tick, to end a commit's wait
+// for other system calls to join it.
+void logtick(void) {
+  if (log.gathering) wakeup(&log);
+}
+
 // called at the end of each FS system call.
 // commits if this was the last outstanding operation.
 void end_op(void) {
-  int do_commit = 0;
+  int do_commit = 0, shared = 0, nops;
+  uint t0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
   if (log.committing) panic("log.committing");
-  if (log.outstanding == 0) {
+  if (log.outstanding == 0 && !log.gathering) {
     do_commit = 1;
-    log.committing = 1;
+    log.gathering = 1;
+    shared = log.nops > 1;
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
+    // the amount of reserved space. a gathering end_op()
+    // may be waiting for log.outstanding to reach zero.
     wakeup(&log);
   }
   release(&log.lock);
 
   if (do_commit) {
+    acquire(&log.lock);
+    if (shared) {
+      // other processes are doing FS system calls too;
+      // let them join this transaction. logtick() wakes us
+      // when the time may be up.
+      log.ngather++;
+      nops = log.nops;
+      t0 = ticks;
+      while (log.outstanding > 0 || (log.nops == nops && ticks - t0 < GROUPTICKS && logroom()))
+        sleep(&log, &log.lock);
+    }
+    while (log.outstanding > 0) sleep(&log, &log.lock);
+    log.gathering = 0;
+    log.committing = 1;
+    log.ncommit++;
+    log.nopstot += log.nops;
+    if (log.nops > log.maxops) log.maxops = log.nops;
+    log.nblocks += log.lh.n;
+    log.ndatatot += log.ndata;
+    log.nops = 0;
+    release(&log.lock);
+
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
@@ -157,28 +247,41 @@ void end_op(void) {
   }
 }
 
-// Copy modified blocks from cache to log.
+// Write file data blocks in place, and copy modified blocks
+// from cache to log.
 static void write_log(void) {
-  int tail;
+  struct buf **b = log.bufs, **to = log.bufs + log.ndata;
+  int i, tail;
 
+  for (i = 0; i < log.ndata; i++) b[i] = bread(log.dev, log.data[i]);  // data block, in the cache
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start + tail + 1);  // log block
+    to[tail] = bread(log.dev, log.start + tail + 1);        // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]);  // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    memmove(to[tail]->data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
   }
+  bwritestart(b, log.ndata + log.lh.n);  // write them all, in a few large operations
+  for (i = 0; i < log.ndata + log.lh.n; i++) {
+    bwait(b[i]);
+    if (i < log.ndata) bunpin(b[i]);
+    brelse(b[i]);
+  }
+  log.ndata = 0;
 }
 
 static void commit() {
+  if (log.lh.n > 0 || log.ndata > 0) write_log();  // Write data home, and modified blocks from cache to log
   if (log.lh.n > 0) {
-    write_log();      // Write modified blocks from cache to log
     write_head();     // Write header to disk -- the real commit
     install_trans();  // Now install writes to home locations
     log.lh.n = 0;
     write_head();  // Erase the transaction from the log
   }
+  if (log.nfreed > 0) {
+    // the frees are on disk; the blocks can be reused.
+    memset(log.freed, 0, (log.nbits + 7) / 8);
+    log.nfreed = 0;
+  }
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -193,7 +296,7 @@ static void commit() {
 void log_write(struct buf *b) {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1) panic("too big a transaction");
+  if (log.lh.n >= log.size - 1) panic("too big a transaction");
   if (log.outstanding < 1) panic("log_write outside of trans");
 
   acquire(&log.lock);
@@ -208,3 +311,56 @@ void log_write(struct buf *b) {
   }
   release(&log.lock);
 }
+
+// Caller has modified b->data, a block of file data, and is
+// done with the buffer. Like log_write(), but unless LOGDATA
+// is set the block isn't logged: commit() writes it in place.
+void log_order(struct buf *b) {
+  int i;
+
+  if (LOGDATA) {
+    log_write(b);
+    return;
+  }
+  if (log.ndata >= NLOGDATA) panic("too much data in a transaction");
+  if (log.outstanding < 1) panic("log_order outside of trans");
+
+  acquire(&log.lock);
+  for (i = 0; i < log.ndata; i++) {
+    if (log.data[i] == b->blockno)  // absorbtion
+      break;
+  }
+  log.data[i] = b->blockno;
+  if (i == log.ndata) {
+    bpin(b);
+    log.ndata++;
+  }
+  release(&log.lock);
+}
+
+// Note that the current transaction frees block b.
+void log_bfree(uint b) {
+  if (LOGDATA) return;
+  acquire(&log.lock);
+  log.freed[b / 8] |= 1 << (b % 8);
+  log.nfreed++;
+  release(&log.lock);
+}
+
+// May block b, which is free on disk, be allocated?
+// Not if the current transaction freed it; see above.
+int log_canreuse(uint b) {
+  int r;
+
+  if (LOGDATA) return 1;
+  acquire(&log.lock);
+  r = (log.freed[b / 8] & (1 << (b % 8))) == 0;
+  release(&log.lock);
+  return r;
+}
+
+// Format the log's counters into buf, for the statistics device.
+int logstats(char *buf, int sz) {
+  return snprintf(buf, sz, "log: size %d commits %d ops %d gathered %d max batch %d blocks %d data blocks %d\n",
+                  log.size, log.ncommit, log.nopstot, log.ngather, log.maxops, log.nblocks, log.ndatatot);
+}
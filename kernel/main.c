@@ -23,7 +23,9 @@ void main() {
     plicinithart();      // ask PLIC for device interrupts
     binit();             // buffer cache
     iinit();             // inode cache
+    dcinit();            // directory name cache
     fileinit();          // file table
+    statsinit();         // statistics device
     virtio_disk_init();  // emulated hard disk
     userinit();          // first user process
     __sync_synchronize();
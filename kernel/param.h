@@ -1,13 +1,31 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO         4  // scheduling priority levels
+#define QUANTUM       1  // time slice at the top level, in ticks; it doubles each level down
+#define TICKCYCLES 1000000  // timer cycles per tick; about 1/10th second in qemu
+#define BOOSTTICKS  100  // how often every process returns to the top level
+#define NWAITQ       61  // hash buckets for the channels of sleeping processes
+#define NPIDHASH     64  // hash buckets for looking processes up by pid
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // minimum size of inode cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NSEG          4  // demand-loaded program segments per process
+#define MAXOPBLOCKS  12  // max # of blocks any FS op writes
+#define LOGSIZE      (MAXOPBLOCKS*3)  // min blocks in on-disk log; mkfs may choose more
+#define LOGMAX       254  // max blocks in on-disk log, as many as its header can list
+#define LOGDIV       16   // mkfs gives the log 1/LOGDIV of the disk, within those bounds
+#define LOGDATA      0    // 1 to log file data too; 0 to log only metadata
+#define MAXOPDATA    64   // max # of file data blocks an FS op writes
+#define NLOGDATA     (MAXOPDATA*3)  // max file data blocks in a transaction
+#define GROUPTICKS   1    // ticks a commit waits for more FS sys calls to join it
+#define NBUF         (LOGMAX+NLOGDATA+MAXOPBLOCKS)  // minimum size of disk block cache
+#define BCACHEDIV    16  // disk block cache gets 1/BCACHEDIV of free memory
+#define ICACHEDIV    64  // inode cache gets an inode per ICACHEDIV free pages
+#define NREADAHEAD   8   // blocks to read ahead of a sequential reader
+#define NDCACHE      512 // entries in the directory name cache
+#define FSSIZE       4000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER     10    // largest contiguous allocation is 2^MAXORDER pages
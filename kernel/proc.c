@@ -12,8 +12,58 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Each CPU has a queue of RUNNABLE processes. A process goes on
+// the queue of the CPU it last ran on, and a CPU whose own queue
+// is empty takes a process from another CPU's queue.
+//
+// The queues are multilevel feedback queues: a CPU runs the
+// processes of the highest priority level (0) first. A process
+// that uses up its time slice drops a level, and the slice doubles
+// with each level down; a process that blocks before then rises a
+// level when it wakes. Every BOOSTTICKS ticks all queued processes
+// return to the top, so that those at low levels don't starve.
+// setpriority() keeps a process from rising above level p->nice.
+//
+// A CPU with nothing to run sleeps in wfi with its clock stopped
+// (except CPU 0, which keeps time), so ready() gives it a clock
+// interrupt to wake it when there is work.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];  // through p->rqnext
+  struct proc *tail[NPRIO];
+  int n;        // processes queued
+  uint epoch;   // ticks / BOOSTTICKS at the last boost
+  int idle;     // the CPU is in wfi, or about to be
+  int nidle;    // times the CPU went idle
+  int nswitch;  // processes this CPU has run
+  int nsteal;   // of those, taken from other CPUs' queues
+} runq[NCPU];
+
+#define SLICE(prio) (QUANTUM << (prio))
+
+// A sleeping process is on the wait queue its channel hashes to,
+// so that wakeup() need only look at the processes sleeping on
+// channels that hash alike. Lock order: the sleeper's condition
+// lock, then p->lock, then the wait queue's lock.
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;  // through p->wqnext
+} waitq[NWAITQ];
+
+#define WAITQ(chan) (&waitq[((uint64)(chan) >> 3) % NWAITQ])
+
+// processes wakeup() collects from a wait queue at a time.
+#define NWAKE 16
+
+// pid_lock protects nextpid, the pid hash table and the list
+// of UNUSED procs, so that allocating a proc and finding one by
+// pid needn't look through proc[].
 int nextpid = 1;
 struct spinlock pid_lock;
+struct proc *pidhash[NPIDHASH];  // through p->pidnext
+struct proc *freeprocs;          // UNUSED procs, through p->pidnext
+
+#define PIDHASH(pid) (&pidhash[(pid) % NPIDHASH])
 
 extern void forkret(void);
 static void wakeup1(struct proc *chan);
@@ -26,6 +76,8 @@ void procinit(void) {
   struct proc *p;
 
   initlock(&pid_lock, "nextpid");
+  for (struct runq *rq = runq; rq < &runq[NCPU]; rq++) initlock(&rq->lock, "runq");
+  for (struct waitq *wq = waitq; wq < &waitq[NWAITQ]; wq++) initlock(&wq->lock, "waitq");
   for (p = proc; p < &proc[NPROC]; p++) {
     initlock(&p->lock, "proc");
 
@@ -37,6 +89,9 @@ void procinit(void) {
     uint64 va = KSTACK((int)(p - proc));
     kvmmap(va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
     p->kstack = va;
+
+    p->pidnext = freeprocs;
+    freeprocs = p;
   }
   kvminithart();
 }
@@ -66,39 +121,139 @@ struct proc *myproc(void) {
   return p;
 }
 
-int allocpid() {
-  int pid;
+// Give p a pid, and enter it in the pid hash table.
+// Caller must hold p->lock.
+static void allocpid(struct proc *p) {
+  struct proc **h;
 
   acquire(&pid_lock);
-  pid = nextpid;
+  p->pid = nextpid;
   nextpid = nextpid + 1;
+  h = PIDHASH(p->pid);
+  p->pidnext = *h;
+  *h = p;
   release(&pid_lock);
+}
 
-  return pid;
+// Return the process with the given pid, locked, or 0.
+static struct proc *findproc(int pid) {
+  struct proc *p;
+
+  acquire(&pid_lock);
+  for (p = *PIDHASH(pid); p != 0; p = p->pidnext)
+    if (p->pid == pid) break;
+  release(&pid_lock);
+  if (p == 0) return 0;
+
+  // p may have been freed since we found it; pids are
+  // never reused, so it is still ours if the pid matches.
+  acquire(&p->lock);
+  if (p->pid != pid || p->state == UNUSED) {
+    release(&p->lock);
+    return 0;
+  }
+  return p;
+}
+
+// Append p to level prio of rq. Caller must hold rq->lock.
+static void runqput(struct runq *rq, struct proc *p, int prio) {
+  p->rqnext = 0;
+  if (rq->head[prio] == 0)
+    rq->head[prio] = p;
+  else
+    rq->tail[prio]->rqnext = p;
+  rq->tail[prio] = p;
+}
+
+// Mark p RUNNABLE and put it on its CPU's run queue. Wake
+// that CPU if it is idle, or else an idle CPU to take p.
+// Caller must hold p->lock.
+static void ready(struct proc *p) {
+  struct runq *rq = &runq[p->cpu];
+  int idle;
+
+  if (p->state == SLEEPING && p->prio > p->nice) {
+    // it blocked before using up its slice.
+    p->prio--;
+    p->ticks = 0;
+  }
+  p->state = RUNNABLE;
+  acquire(&rq->lock);
+  runqput(rq, p, p->prio);
+  rq->n++;
+  idle = rq->idle;
+  release(&rq->lock);
+
+  if (idle) {
+    timerkick(p->cpu);
+    return;
+  }
+  // reads the other CPUs' idle without their locks; at worst
+  // this wakes a CPU for nothing, or p waits for its own CPU.
+  for (int i = 0; i < NCPU; i++) {
+    if (runq[i].idle) {
+      timerkick(i);
+      break;
+    }
+  }
+}
+
+// Move the processes below the top level of rq up to their
+// highest allowed level. Caller must hold rq->lock.
+static void runqboost(struct runq *rq) {
+  struct proc *p, *next;
+
+  for (int prio = 1; prio < NPRIO; prio++) {
+    p = rq->head[prio];
+    rq->head[prio] = rq->tail[prio] = 0;
+    for (; p != 0; p = next) {
+      next = p->rqnext;
+      // reads p->nice without p->lock; a stale value only
+      // puts p on the wrong level until it next runs.
+      runqput(rq, p, p->nice);
+    }
+  }
+}
+
+// Take the first process of the highest non-empty level of rq,
+// if any, and set *prio to the level.
+static struct proc *runqget(struct runq *rq, int *prio) {
+  struct proc *p = 0;
+
+  acquire(&rq->lock);
+  if (rq->epoch != ticks / BOOSTTICKS) {
+    rq->epoch = ticks / BOOSTTICKS;
+    runqboost(rq);
+  }
+  for (*prio = 0; *prio < NPRIO; (*prio)++) {
+    if ((p = rq->head[*prio]) != 0) {
+      rq->head[*prio] = p->rqnext;
+      rq->n--;
+      break;
+    }
+  }
+  release(&rq->lock);
+  return p;
 }
 
-// Look in the process table for an UNUSED proc.
+// Take an UNUSED proc from the free list.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc *allocproc(void) {
   struct proc *p;
 
-  for (p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if (p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
-  }
-  return 0;
+  acquire(&pid_lock);
+  if ((p = freeprocs) != 0) freeprocs = p->pidnext;
+  release(&pid_lock);
+  if (p == 0) return 0;
 
-found:
-  p->pid = allocpid();
+  acquire(&p->lock);
+  allocpid(p);
 
   // Allocate a trapframe page.
   if ((p->trapframe = (struct trapframe *)kalloc()) == 0) {
+    freeproc(p);
     release(&p->lock);
     return 0;
   }
@@ -111,6 +266,14 @@ found:
     return 0;
   }
 
+  // The kernel page table to use while running p.
+  p->kpagetable = kvmcreate(p->pagetable);
+  if (p->kpagetable == 0) {
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -121,16 +284,39 @@ found:
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
+// including user pages, and put it back on the free list.
 // p->lock must be held.
 static void freeproc(struct proc *p) {
+  struct proc **pp;
+
   if (p->trapframe) kfree((void *)p->trapframe);
   p->trapframe = 0;
+  // just the root; the rest belongs to the kernel
+  // and to p->pagetable.
+  if (p->kpagetable) kfree((void *)p->kpagetable);
+  p->kpagetable = 0;
   if (p->pagetable) proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+
+  acquire(&pid_lock);
+  for (pp = PIDHASH(p->pid); *pp != 0; pp = &(*pp)->pidnext) {
+    if (*pp == p) {
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  p->pidnext = freeprocs;
+  freeprocs = p;
+  release(&pid_lock);
+
   p->pid = 0;
+  p->nice = 0;
+  p->prio = 0;
+  p->ticks = 0;
   p->parent = 0;
+  p->children = 0;
+  p->sibling = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
@@ -163,6 +349,12 @@ pagetable_t proc_pagetable(struct proc *p) {
     return 0;
   }
 
+  // the kernel's devices, for p's kernel page table.
+  if (uvmkshare(pagetable) < 0) {
+    proc_freepagetable(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -171,6 +363,7 @@ pagetable_t proc_pagetable(struct proc *p) {
 void proc_freepagetable(pagetable_t pagetable, uint64 sz) {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmkunshare(pagetable);
   uvmfree(pagetable, sz);
 }
 
@@ -202,7 +395,8 @@ void userinit(void) {
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  p->cpu = cpuid();
+  ready(p);
 
   release(&p->lock);
 }
@@ -210,16 +404,18 @@ void userinit(void) {
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int growproc(int n) {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
 
   sz = p->sz;
   if (n > 0) {
-    if ((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
-      return -1;
-    }
+    // Only reserve the address space; uvmfault() allocates
+    // each page when it is first touched.
+    if (sz + n > USERTOP) return -1;
+    sz += n;
   } else if (n < 0) {
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    exectrim(p, sz);
   }
   p->sz = sz;
   return 0;
@@ -257,39 +453,52 @@ int fork(void) {
   for (i = 0; i < NOFILE; i++)
     if (p->ofile[i]) np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if (p->exe) {
+    np->exe = idup(p->exe);
+    iexecbegin(np->exe);  // can't fail: p already runs it
+  }
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  np->nice = np->prio = p->nice;
+
   pid = np->pid;
 
-  np->state = RUNNABLE;
+  release(&np->lock);
+
+  // put np on p's list of children, under p->lock, before it
+  // can run and exit.
+  acquire(&p->lock);
+  np->sibling = p->children;
+  p->children = np;
+  release(&p->lock);
 
+  acquire(&np->lock);
+  np->cpu = cpuid();
+  ready(np);
   release(&np->lock);
 
   return pid;
 }
 
 // Pass p's abandoned children to init.
-// Caller must hold p->lock.
+// Caller must hold initproc->lock and p->lock, in that order,
+// which is ancestor before descendant, as for the children's.
 void reparent(struct proc *p) {
-  struct proc *pp;
-
-  for (pp = proc; pp < &proc[NPROC]; pp++) {
-    // this code uses pp->parent without holding pp->lock.
-    // acquiring the lock first could cause a deadlock
-    // if pp or a child of pp were also in exit()
-    // and about to try to lock p.
-    if (pp->parent == p) {
-      // pp->parent can't change between the check and the acquire()
-      // because only the parent changes it, and we're the parent.
-      acquire(&pp->lock);
-      pp->parent = initproc;
-      // we should wake up init here, but that would require
-      // initproc->lock, which would be a deadlock, since we hold
-      // the lock on one of init's children (pp). this is why
-      // exit() always wakes init (before acquiring any locks).
-      release(&pp->lock);
-    }
+  struct proc *pp, *last = 0;
+
+  for (pp = p->children; pp != 0; pp = pp->sibling) {
+    acquire(&pp->lock);
+    pp->parent = initproc;
+    release(&pp->lock);
+    last = pp;
+  }
+  if (last) {
+    last->sibling = initproc->children;
+    initproc->children = p->children;
+    p->children = 0;
   }
 }
 
@@ -312,36 +521,42 @@ void exit(int status) {
 
   begin_op();
   iput(p->cwd);
+  if (p->exe) {
+    iexecend(p->exe);
+    iput(p->exe);
+  }
   end_op();
   p->cwd = 0;
+  p->exe = 0;
+  p->nseg = 0;
 
-  // we might re-parent a child to init. we can't be precise about
-  // waking up init, since we can't acquire its lock once we've
-  // acquired any other proc lock. so wake up init whether that's
-  // necessary or not. init may miss this wakeup, but that seems
-  // harmless.
-  acquire(&initproc->lock);
-  wakeup1(initproc);
-  release(&initproc->lock);
-
-  // grab a copy of p->parent, to ensure that we unlock the same
-  // parent we locked. in case our parent gives us away to init while
-  // we're waiting for the parent lock. we may then race with an
-  // exiting parent, but the result will be a harmless spurious wakeup
-  // to a dead or wrong process; proc structs are never re-allocated
-  // as anything else.
-  acquire(&p->lock);
-  struct proc *original_parent = p->parent;
-  release(&p->lock);
+  // Give any children to init, and wake it in case some of
+  // them have already exited.
+  if (p->children) {
+    acquire(&initproc->lock);
+    acquire(&p->lock);
+    reparent(p);
+    release(&p->lock);
+    wakeup1(initproc);
+    release(&initproc->lock);
+  }
 
   // we need the parent's lock in order to wake it up from wait().
-  // the parent-then-child rule says we have to lock it first.
-  acquire(&original_parent->lock);
-
-  acquire(&p->lock);
+  // the parent-then-child rule says we have to lock it first, so
+  // grab a copy of p->parent, and try again if our parent gives
+  // us away to init while we're waiting for its lock.
+  struct proc *original_parent;
+  for (;;) {
+    acquire(&p->lock);
+    original_parent = p->parent;
+    release(&p->lock);
 
-  // Give any children to init.
-  reparent(p);
+    acquire(&original_parent->lock);
+    acquire(&p->lock);
+    if (p->parent == original_parent) break;
+    release(&p->lock);
+    release(&original_parent->lock);
+  }
 
   // Parent might be sleeping in wait().
   wakeup1(original_parent);
@@ -359,41 +574,38 @@ void exit(int status) {
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int wait(uint64 addr) {
-  struct proc *np;
+  struct proc *np, **pp;
   int havekids, pid;
   struct proc *p = myproc();
 
+  // copyout() below can't read pages in under p->lock.
+  if (addr != 0) execprefault(addr, sizeof(int));
+
   // hold p->lock for the whole time to avoid lost
   // wakeups from a child's exit().
   acquire(&p->lock);
 
   for (;;) {
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for (np = proc; np < &proc[NPROC]; np++) {
-      // this code uses np->parent without holding np->lock.
-      // acquiring the lock first would cause a deadlock,
-      // since np might be an ancestor, and we already hold p->lock.
-      if (np->parent == p) {
-        // np->parent can't change between the check and the acquire()
-        // because only the parent changes it, and we're the parent.
-        acquire(&np->lock);
-        havekids = 1;
-        if (np->state == ZOMBIE) {
-          // Found one.
-          pid = np->pid;
-          if (addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate, sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&p->lock);
-            return -1;
-          }
-          freeproc(np);
+    for (pp = &p->children; (np = *pp) != 0; pp = &np->sibling) {
+      acquire(&np->lock);
+      havekids = 1;
+      if (np->state == ZOMBIE) {
+        // Found one.
+        pid = np->pid;
+        if (addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate, sizeof(np->xstate)) < 0) {
           release(&np->lock);
           release(&p->lock);
-          return pid;
+          return -1;
         }
+        *pp = np->sibling;
+        freeproc(np);
         release(&np->lock);
+        release(&p->lock);
+        return pid;
       }
+      release(&np->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -417,35 +629,78 @@ int wait(uint64 addr) {
 void scheduler(void) {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
+  struct runq *rq = &runq[id];
+  int prio;
 
   c->proc = 0;
   for (;;) {
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
+    // A process preempted in copyin() or copyout() left user
+    // memory accessible; its kerneltrap() restores that on resume.
+    w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+
+    // Run the next process on this CPU's queue, or else one
+    // from another CPU's. Peek at the other queues without
+    // their locks, so that idle CPUs don't take them needlessly.
+    if ((p = runqget(rq, &prio)) == 0) {
+      for (int i = 1; i < NCPU && p == 0; i++) {
+        struct runq *other = &runq[(id + i) % NCPU];
+        if (other->n != 0) p = runqget(other, &prio);
+      }
+      if (p) rq->nsteal++;
+    }
 
-    int found = 0;
-    for (p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if (p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-
-        found = 1;
+    if (p == 0) {
+      // Nothing to run: zero a page for kzalloc(), or sleep
+      // if there is no such work left either. With interrupts
+      // off, a kick from ready() after we are marked idle
+      // stays pending, so wfi returns at once.
+      if (kzeroidle() != 0) continue;
+      intr_off();
+      if (id != 0) timeroff();
+      acquire(&rq->lock);
+      rq->idle = rq->n == 0;
+      release(&rq->lock);
+      if (rq->idle) {
+        rq->nidle++;
+        asm volatile("wfi");
       }
-      release(&p->lock);
+      acquire(&rq->lock);
+      rq->idle = 0;
+      release(&rq->lock);
+      if (id != 0) timeron();
+      continue;
     }
-    if (found == 0) {
-      intr_on();
-      asm volatile("wfi");
+
+    acquire(&p->lock);
+    if (p->state != RUNNABLE) panic("scheduler");
+    // a boost may have raised p, or setpriority() lowered it.
+    if (prio < p->prio) {
+      p->prio = prio;
+      p->ticks = 0;
     }
+    if (p->prio < p->nice) {
+      p->prio = p->nice;
+      p->ticks = 0;
+    }
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = id;
+    c->proc = p;
+    rq->nswitch++;
+    w_satp(MAKE_SATP(p->kpagetable));
+    sfence_vma();
+    swtch(&c->context, &p->context);
+    kvminithart();
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -470,11 +725,31 @@ void sched(void) {
   mycpu()->intena = intena;
 }
 
+// Charge the current process for a clock tick. Return 1 if it
+// should give up the CPU: it has used up its slice, which drops
+// it a level, and another process is waiting, or a process of
+// higher priority is waiting.
+int schedtick(void) {
+  struct proc *p = myproc();
+  int r = 0;
+
+  acquire(&p->lock);
+  if (++p->ticks >= SLICE(p->prio)) {
+    if (p->prio < NPRIO - 1) p->prio++;
+    p->ticks = 0;
+    r = runq[p->cpu].n != 0;
+  }
+  for (int prio = 0; prio < p->prio && r == 0; prio++)
+    if (runq[p->cpu].head[prio] != 0) r = 1;
+  release(&p->lock);
+  return r;
+}
+
 // Give up the CPU for one scheduling round.
 void yield(void) {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  ready(p);
   sched();
   release(&p->lock);
 }
@@ -502,22 +777,29 @@ void forkret(void) {
 // Reacquires lock when awakened.
 void sleep(void *chan, struct spinlock *lk) {
   struct proc *p = myproc();
+  struct waitq *wq = WAITQ(chan);
 
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
-  // so it's okay to release lk.
+  // Once we hold p->lock and are on chan's
+  // wait queue, we can be guaranteed that we
+  // won't miss any wakeup (wakeup looks in the
+  // queue, and locks p->lock), so it's okay
+  // to release lk.
   if (lk != &p->lock) {  // DOC: sleeplock0
     acquire(&p->lock);   // DOC: sleeplock1
-    release(lk);
   }
 
   // Go to sleep.
   p->chan = chan;
+  acquire(&wq->lock);
+  p->wqnext = wq->head;
+  wq->head = p;
+  release(&wq->lock);
   p->state = SLEEPING;
 
+  if (lk != &p->lock) release(lk);
+
   sched();
 
   // Tidy up.
@@ -530,18 +812,57 @@ void sleep(void *chan, struct spinlock *lk) {
   }
 }
 
+// Take sleeping p off its wait queue, if it is still there,
+// and make it RUNNABLE. Caller must hold p->lock.
+static void wake(struct proc *p) {
+  struct waitq *wq = WAITQ(p->chan);
+  struct proc **pp;
+
+  acquire(&wq->lock);
+  for (pp = &wq->head; *pp != 0; pp = &(*pp)->wqnext) {
+    if (*pp == p) {
+      *pp = p->wqnext;
+      break;
+    }
+  }
+  release(&wq->lock);
+  ready(p);
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void wakeup(void *chan) {
-  struct proc *p;
+  struct waitq *wq = WAITQ(chan);
+  struct proc *p, **pp, *woken[NWAKE];
+  int i, n;
+
+  do {
+    // take the sleepers on chan off the queue. wakeup can't
+    // lock them while holding wq->lock, since sleep() locks
+    // them first; so check again under p->lock below, in case
+    // one has been woken, or even gone back to sleep, since.
+    n = 0;
+    acquire(&wq->lock);
+    for (pp = &wq->head; *pp != 0 && n < NWAKE;) {
+      p = *pp;
+      if (p->chan == chan) {
+        *pp = p->wqnext;
+        woken[n++] = p;
+      } else {
+        pp = &p->wqnext;
+      }
+    }
+    release(&wq->lock);
 
-  for (p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if (p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
+    for (i = 0; i < n; i++) {
+      p = woken[i];
+      acquire(&p->lock);
+      if (p->state == SLEEPING && p->chan == chan) {
+        wake(p);
+      }
+      release(&p->lock);
     }
-    release(&p->lock);
-  }
+  } while (n == NWAKE);
 }
 
 // Wake up p if it is sleeping in wait(); used by exit().
@@ -549,7 +870,7 @@ void wakeup(void *chan) {
 static void wakeup1(struct proc *p) {
   if (!holding(&p->lock)) panic("wakeup1");
   if (p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
+    wake(p);
   }
 }
 
@@ -559,20 +880,46 @@ static void wakeup1(struct proc *p) {
 int kill(int pid) {
   struct proc *p;
 
-  for (p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if (p->pid == pid) {
-      p->killed = 1;
-      if (p->state == SLEEPING) {
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+  if ((p = findproc(pid)) == 0) return -1;
+  p->killed = 1;
+  if (p->state == SLEEPING) {
+    // Wake process from sleep().
+    wake(p);
   }
-  return -1;
+  release(&p->lock);
+  return 0;
+}
+
+// Format the run queues' counters into buf, for the statistics device.
+int schedstats(char *buf, int sz) {
+  int n = 0;
+
+  for (struct runq *rq = runq; rq < &runq[NCPU]; rq++) {
+    if (rq->nswitch == 0) continue;
+    n += snprintf(buf + n, sz - n, "sched: cpu %d switches %d steals %d idle %d #acquire() %d #test-and-set %d\n",
+                  (int)(rq - runq), rq->nswitch, rq->nsteal, rq->nidle, rq->lock.n, rq->lock.nts);
+  }
+  return n;
+}
+
+// Keep the process with the given pid, or the current process
+// if pid is 0, from running above priority level nice.
+// Return the old level, or -1.
+int setpriority(int pid, int nice) {
+  struct proc *p;
+  int old;
+
+  if (nice < 0 || nice >= NPRIO) return -1;
+  if (pid == 0) pid = myproc()->pid;
+  if ((p = findproc(pid)) == 0) return -1;
+  old = p->nice;
+  p->nice = nice;
+  if (p->prio < nice) {
+    p->prio = nice;
+    p->ticks = 0;
+  }
+  release(&p->lock);
+  return old;
 }
 
 // Copy to either a user address, or kernel address,
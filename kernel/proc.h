@@ -82,6 +82,14 @@ struct trapframe {
 
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A program segment that exec() mapped without reading it;
+// uvmfault() reads each page from the executable on first touch.
+struct seg {
+  uint64 va;      // page-aligned start
+  uint64 filesz;  // bytes backed by the executable; the rest is zero
+  uint64 off;     // file offset of va
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -93,14 +101,36 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue p goes on
+  int prio;                    // Priority level, 0 highest
+  int nice;                    // Highest level p may rise to
+  int ticks;                   // Ticks run at level prio
+
+  // the lock of p's run queue must be held when using this:
+  struct proc *rqnext;         // Next process in the run queue
+
+  // the lock of p->chan's wait queue must be held when using this:
+  struct proc *wqnext;         // Next process in the wait queue
+
+  // p->lock must be held when using children, and the
+  // parent's lock when using sibling:
+  struct proc *children;       // First child
+  struct proc *sibling;        // Next child of the parent
+
+  // pid_lock must be held when using this:
+  struct proc *pidnext;        // Next in p's pid hash chain, or on the free list
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table, sharing the user memory
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Executable that seg[] is read from
+  struct seg seg[NSEG];        // Demand-loaded program segments
+  int nseg;
   char name[16];               // Process name (debugging)
 };
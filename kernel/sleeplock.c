@@ -26,6 +26,21 @@ void acquiresleep(struct sleeplock *lk) {
   release(&lk->lk);
 }
 
+// Acquire lk if no one holds it, without sleeping.
+// Return 1 if it was acquired, 0 if not.
+int tryacquiresleep(struct sleeplock *lk) {
+  int r = 0;
+
+  acquire(&lk->lk);
+  if (!lk->locked) {
+    lk->locked = 1;
+    lk->pid = myproc()->pid;
+    r = 1;
+  }
+  release(&lk->lk);
+  return r;
+}
+
 void releasesleep(struct sleeplock *lk) {
   acquire(&lk->lk);
   lk->locked = 0;
@@ -12,6 +12,8 @@ void initlock(struct spinlock *lk, char *name) {
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->n = 0;
+  lk->nts = 0;
 }
 
 // Acquire the lock.
@@ -24,8 +26,9 @@ void acquire(struct spinlock *lk) {
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
-  while (__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  while (__sync_lock_test_and_set(&lk->locked, 1) != 0) {
+    __sync_fetch_and_add(&lk->nts, 1);
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -35,6 +38,7 @@ void acquire(struct spinlock *lk) {
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->n++;
 }
 
 // Release the lock.
@@ -0,0 +1,84 @@
+//
+// formatted output into a kernel buffer -- snprintf.
+//
+
+#include <stdarg.h>
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+static char digits[] = "0123456789abcdef";
+
+static int sputc(char *s, int off, int sz, char c) {
+  if (off < sz) s[off] = c;
+  return off < sz;
+}
+
+static int sprintint(char *s, int off, int sz, int xx, int base, int sign) {
+  char buf[16];
+  int i, n;
+  uint x;
+
+  if (sign && (sign = xx < 0))
+    x = -xx;
+  else
+    x = xx;
+
+  i = 0;
+  do {
+    buf[i++] = digits[x % base];
+  } while ((x /= base) != 0);
+
+  if (sign) buf[i++] = '-';
+
+  n = 0;
+  while (--i >= 0) n += sputc(s, off + n, sz, buf[i]);
+  return n;
+}
+
+// Print into buf, writing at most sz bytes; no terminating nul.
+// Only understands %d, %x, %s.
+// Returns the number of bytes written.
+int snprintf(char *buf, int sz, char *fmt, ...) {
+  va_list ap;
+  int i, c;
+  int off = 0;
+  char *s;
+
+  if (fmt == 0) panic("null fmt");
+
+  va_start(ap, fmt);
+  for (i = 0; off < sz && (c = fmt[i] & 0xff) != 0; i++) {
+    if (c != '%') {
+      off += sputc(buf, off, sz, c);
+      continue;
+    }
+    c = fmt[++i] & 0xff;
+    if (c == 0) break;
+    switch (c) {
+      case 'd':
+        off += sprintint(buf, off, sz, va_arg(ap, int), 10, 1);
+        break;
+      case 'x':
+        off += sprintint(buf, off, sz, va_arg(ap, int), 16, 0);
+        break;
+      case 's':
+        if ((s = va_arg(ap, char *)) == 0) s = "(null)";
+        for (; *s && off < sz; s++) off += sputc(buf, off, sz, *s);
+        break;
+      case '%':
+        off += sputc(buf, off, sz, '%');
+        break;
+      default:
+        // Print unknown % sequence to draw attention.
+        off += sputc(buf, off, sz, '%');
+        off += sputc(buf, off, sz, c);
+        break;
+    }
+  }
+  va_end(ap);
+  return off;
+}
@@ -0,0 +1,72 @@
+//
+// The statistics device: reading it returns a text snapshot of
+// kernel counters (lock contention, allocator and cache activity).
+// Each read() continues the snapshot taken by the first read;
+// a read that returns 0 marks the end and resets for the next one,
+// so cat statistics works.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define BUFSZ 4096
+
+static struct {
+  struct spinlock lock;
+  char buf[BUFSZ];
+  int sz;
+  int off;
+} stats;
+
+// Render every subsystem's counters into buf.
+static int statsfill(char *buf, int sz) {
+  int n = 0;
+
+  n += kallocstats(buf + n, sz - n);
+  n += kvmstats(buf + n, sz - n);
+  n += biostats(buf + n, sz - n);
+  n += logstats(buf + n, sz - n);
+  n += icachestats(buf + n, sz - n);
+  n += dcachestats(buf + n, sz - n);
+  n += virtio_disk_stats(buf + n, sz - n);
+  n += schedstats(buf + n, sz - n);
+  return n;
+}
+
+int statswrite(int user_src, uint64 src, int n) { return -1; }
+
+int statsread(int user_dst, uint64 dst, int n) {
+  int m;
+
+  acquire(&stats.lock);
+
+  if (stats.sz == 0) stats.sz = statsfill(stats.buf, BUFSZ);
+  m = stats.sz - stats.off;
+
+  if (m > 0) {
+    if (m > n) m = n;
+    if (either_copyout(user_dst, dst, stats.buf + stats.off, m) == -1)
+      m = -1;
+    else
+      stats.off += m;
+  } else {
+    m = 0;
+    stats.sz = 0;
+    stats.off = 0;
+  }
+  release(&stats.lock);
+  return m;
+}
+
+void statsinit(void) {
+  initlock(&stats.lock, "stats");
+
+  devsw[STATS].read = statsread;
+  devsw[STATS].write = statswrite;
+}
@@ -179,6 +179,7 @@ uint64 sys_unlink(void) {
 
   memset(&de, 0, sizeof(de));
   if (writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)) panic("unlink: writei");
+  dcenter(dp, name, 0, 0);
   if (ip->type == T_DIR) {
     dp->nlink--;
     iupdate(dp);
@@ -221,6 +222,7 @@ static struct inode *create(char *path, short type, short major, short minor) {
   ip->major = major;
   ip->minor = minor;
   ip->nlink = 1;
+  if (type == T_DIR) ip->flags |= DI_HASHED;
   iupdate(ip);
 
   if (type == T_DIR) {  // Create . and .. entries.
@@ -230,7 +232,18 @@ static struct inode *create(char *path, short type, short major, short minor) {
     if (dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0) panic("create dots");
   }
 
-  if (dirlink(dp, name, ip->inum) < 0) panic("create: dirlink");
+  if (dirlink(dp, name, ip->inum) < 0) {
+    // dp is full; free ip again.
+    if (type == T_DIR) {
+      dp->nlink--;
+      iupdate(dp);
+    }
+    ip->nlink = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    iunlockput(dp);
+    return 0;
+  }
 
   iunlockput(dp);
 
@@ -242,7 +255,7 @@ uint64 sys_open(void) {
   int fd, omode;
   struct file *f;
   struct inode *ip;
-  int n;
+  int n, writing;
 
   if ((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0) return -1;
 
@@ -273,8 +286,18 @@ uint64 sys_open(void) {
     return -1;
   }
 
+  // A program that is running reads its pages from its file; don't let
+  // the file change under it (see iexecbegin).
+  writing = ip->type == T_FILE && (omode & (O_WRONLY | O_RDWR | O_TRUNC));
+  if (writing && iwritebegin(ip) < 0) {
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if ((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0) {
     if (f) fileclose(f);
+    if (writing) iwriteend(ip);
     iunlockput(ip);
     end_op();
     return -1;
@@ -294,6 +317,13 @@ uint64 sys_open(void) {
   if ((omode & O_TRUNC) && ip->type == T_FILE) {
     itrunc(ip);
   }
+  if (writing && !f->writable) iwriteend(ip);  // only truncated it
+
+  if ((omode & O_EXTENT) && ip->type == T_FILE && ip->size == 0 && !(ip->flags & DI_EXTENT)) {
+    itrunc(ip);  // free the blocks of any old mapping
+    ip->flags |= DI_EXTENT;
+    iupdate(ip);
+  }
 
   iunlock(ip);
   end_op();
@@ -69,3 +69,10 @@ uint64 sys_uptime(void) {
   release(&tickslock);
   return xticks;
 }
+
+uint64 sys_setpriority(void) {
+  int pid, nice;
+
+  if (argint(0, &pid) < 0 || argint(1, &nice) < 0) return -1;
+  return setpriority(pid, nice);
+}
@@ -10,6 +10,7 @@ struct spinlock tickslock;
 uint ticks;
 
 extern char trampoline[], uservec[], userret[];
+extern char copyuser_fault[], copyuser_end[];  // copyuser.S
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
@@ -55,6 +56,18 @@ void usertrap(void) {
     syscall();
   } else if ((which_dev = devintr()) != 0) {
     // ok
+  } else if (r_scause() == 12 || r_scause() == 13 || r_scause() == 15) {
+    // page fault. the page may have to be read from the
+    // executable, which sleeps, so allow interrupts, once
+    // done with scause and stval, which interrupts change.
+    uint64 scause = r_scause();
+    uint64 va = r_stval();
+    intr_on();
+    if (uvmfault(p->pagetable, va, scause == 15) != 0) {
+      printf("usertrap(): bad page fault %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, va);
+      p->killed = 1;
+    }
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -64,7 +77,7 @@ void usertrap(void) {
   if (p->killed) exit(-1);
 
   // give up the CPU if this is a timer interrupt.
-  if (which_dev == 2) yield();
+  if (which_dev == 2 && schedtick()) yield();
 
   usertrapret();
 }
@@ -123,14 +136,22 @@ void kerneltrap() {
   if ((sstatus & SSTATUS_SPP) == 0) panic("kerneltrap: not from supervisor mode");
   if (intr_get() != 0) panic("kerneltrap: interrupts enabled");
 
-  if ((which_dev = devintr()) == 0) {
+  if ((scause == 13 || scause == 15) && sepc >= (uint64)copyuser && sepc < (uint64)copyuser_end) {
+    // a page fault in copyin() or copyout()'s direct access to user
+    // memory: make the page present and retry, or fail the copy.
+    // push_off() makes execload() fail rather than sleep here, with
+    // SUM set; the copy routines have read such pages in already.
+    push_off();
+    if (uvmfault(myproc()->pagetable, r_stval(), scause == 15) != 0) sepc = (uint64)copyuser_fault;
+    pop_off();
+  } else if ((which_dev = devintr()) == 0) {
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
   // give up the CPU if this is a timer interrupt.
-  if (which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING) yield();
+  if (which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING && schedtick()) yield();
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -138,13 +159,30 @@ void kerneltrap() {
   w_sstatus(sstatus);
 }
 
+// CPU 0 keeps time. Count ticks from the CLINT's clock rather
+// than from interrupts, since timerkick() causes extra ones.
 void clockintr() {
+  uint now = *(uint64 *)KCLINT_MTIME / TICKCYCLES;
+
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  if (ticks != now) {
+    ticks = now;
+    wakeup(&ticks);
+  }
   release(&tickslock);
+  logtick();
 }
 
+// Stop this CPU's clock interrupts, until timeron().
+void timeroff(void) { *(uint64 *)KCLINT_MTIMECMP(cpuid()) = ~0ULL; }
+
+// Restart this CPU's clock interrupts, a tick from now.
+void timeron(void) { *(uint64 *)KCLINT_MTIMECMP(cpuid()) = *(uint64 *)KCLINT_MTIME + TICKCYCLES; }
+
+// Give CPU id a clock interrupt now, to wake it from wfi.
+// timervec then schedules its next one a tick later.
+void timerkick(int id) { *(uint64 *)KCLINT_MTIMECMP(id) = *(uint64 *)KCLINT_MTIME; }
+
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
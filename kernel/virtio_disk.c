@@ -22,29 +22,44 @@
 
 static struct disk {
   // memory for virtio descriptors &c for queue 0.
-  // this is a global instead of allocated because it must
-  // be multiple contiguous pages, which kalloc()
-  // doesn't support, and page aligned.
-  char pages[2 * PGSIZE];
+  // two physically contiguous, page-aligned pages
+  // from kallocpages().
+  char *pages;
   struct VRingDesc *desc;
   uint16 *avail;
   struct UsedArea *used;
 
   // our own book-keeping.
   char free[NUM];   // is a descriptor free?
-  uint16 used_idx;  // we've looked this far in used[2..NUM].
+  uint16 used_idx;  // we've looked this far in used->elems[], mod 2^16.
+
+  // each operation takes one descriptor in the ring, which
+  // points to an indirect table of its own: the header, a
+  // descriptor per buffer, and the status byte.
+  // the tables are indexed like desc[], and kept here rather
+  // than on the caller's stack, since an operation can outlive
+  // the call that started it.
+  struct VRingDesc ind[NUM][NVIRTIOSEG + 2];
+  struct virtio_blk_outhdr ops[NUM];
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
-  // indexed by first descriptor index of chain.
+  // indexed by the operation's descriptor.
   struct {
-    struct buf *b;
+    struct buf *b[NVIRTIOSEG];
+    int n;
     char status;
+    char write;
   } info[NUM];
 
+  int nreq;      // operations started
+  int nbuf;      // buffers they transferred
+  int inflight;  // operations the device has not finished
+  int maxinflight;
+
   struct spinlock vdisk_lock;
 
-} __attribute__((aligned(PGSIZE))) disk;
+} disk;
 
 void virtio_disk_init(void) {
   uint32 status = 0;
@@ -70,7 +85,7 @@ void virtio_disk_init(void) {
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
+  if ((features & (1 << VIRTIO_RING_F_INDIRECT_DESC)) == 0) panic("virtio disk has no indirect descriptors");
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
 
   // tell device that feature negotiation is complete.
@@ -89,7 +104,8 @@ void virtio_disk_init(void) {
   if (max == 0) panic("virtio disk has no queue 0");
   if (max < NUM) panic("virtio disk max queue too short");
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-  memset(disk.pages, 0, sizeof(disk.pages));
+  if ((disk.pages = kallocpages(1)) == 0) panic("virtio disk kallocpages");
+  memset(disk.pages, 0, 2 * PGSIZE);
   *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
 
   // desc = pages -- num * VRingDesc
@@ -125,123 +141,159 @@ static void free_desc(int i) {
   wakeup(&disk.free[0]);
 }
 
-// free a chain of descriptors.
-static void free_chain(int i) {
-  while (1) {
-    free_desc(i);
-    if (disk.desc[i].flags & VRING_DESC_F_NEXT)
-      i = disk.desc[i].next;
-    else
-      break;
-  }
-}
-
-static int alloc3_desc(int *idx) {
-  for (int i = 0; i < 3; i++) {
-    idx[i] = alloc_desc();
-    if (idx[i] < 0) {
-      for (int j = 0; j < i; j++) free_desc(idx[j]);
-      return -1;
-    }
-  }
-  return 0;
-}
-
-void virtio_disk_rw(struct buf *b, int write) {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
-  // the spec says that legacy block operations use three
-  // descriptors: one for type/reserved/sector, one for
-  // the data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while (1) {
-    if (alloc3_desc(idx) == 0) {
-      break;
-    }
+// start reading or writing the n buffers in b, which must
+// hold consecutive blocks, as a single disk operation.
+// caller must hold disk.vdisk_lock.
+static void virtio_disk_submit(struct buf **b, int n, int write) {
+  uint64 sector = b[0]->blockno * (BSIZE / 512);
+  struct VRingDesc *ind;
+  int i, id;
+
+  if (n < 1 || n > NVIRTIOSEG) panic("virtio_disk_submit");
+  for (i = 1; i < n; i++)
+    if (b[i]->blockno != b[0]->blockno + i) panic("virtio_disk_submit: not consecutive");
+
+  // the spec says that legacy block operations use a chain of
+  // descriptors: one for type/reserved/sector, one for each
+  // piece of the data, one for a 1-byte status result.
+  // the chain lives in an indirect table, so the operation
+  // takes a single descriptor in the ring.
+  while ((id = alloc_desc()) < 0) {
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
+  ind = disk.ind[id];
 
-  // format the three descriptors.
-  // qemu's virtio-blk.c reads them.
+  // format the chain.
+  // qemu's virtio-blk.c reads it.
 
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
+  struct virtio_blk_outhdr *buf0 = &disk.ops[id];
 
   if (write)
-    buf0.type = VIRTIO_BLK_T_OUT;  // write the disk
+    buf0->type = VIRTIO_BLK_T_OUT;  // write the disk
   else
-    buf0.type = VIRTIO_BLK_T_IN;  // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk.desc[idx[0]].addr = (uint64)kvmpa((uint64)&buf0);
-  disk.desc[idx[0]].len = sizeof(buf0);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64)b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if (write)
-    disk.desc[idx[1]].flags = 0;  // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE;  // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
-
-  disk.info[idx[0]].status = 0;
-  disk.desc[idx[2]].addr = (uint64)&disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE;  // device writes the status
-  disk.desc[idx[2]].next = 0;
+    buf0->type = VIRTIO_BLK_T_IN;  // read the disk
+  buf0->reserved = 0;
+  buf0->sector = sector;
+
+  ind[0].addr = (uint64)buf0;
+  ind[0].len = sizeof(*buf0);
+  ind[0].flags = VRING_DESC_F_NEXT;
+  ind[0].next = 1;
+
+  for (i = 1; i <= n; i++) {
+    ind[i].addr = (uint64)b[i - 1]->data;
+    ind[i].len = BSIZE;
+    if (write)
+      ind[i].flags = 0;  // device reads b->data
+    else
+      ind[i].flags = VRING_DESC_F_WRITE;  // device writes b->data
+    ind[i].flags |= VRING_DESC_F_NEXT;
+    ind[i].next = i + 1;
+  }
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.info[id].status = 0;
+  ind[n + 1].addr = (uint64)&disk.info[id].status;
+  ind[n + 1].len = 1;
+  ind[n + 1].flags = VRING_DESC_F_WRITE;  // device writes the status
+  ind[n + 1].next = 0;
+
+  disk.desc[id].addr = (uint64)ind;
+  disk.desc[id].len = (n + 2) * sizeof(struct VRingDesc);
+  disk.desc[id].flags = VRING_DESC_F_INDIRECT;
+  disk.desc[id].next = 0;
+
+  // record the bufs for virtio_disk_intr().
+  for (i = 0; i < n; i++) {
+    b[i]->disk = 1;
+    disk.info[id].b[i] = b[i];
+  }
+  disk.info[id].n = n;
+  disk.info[id].write = write;
+  disk.nreq++;
+  disk.nbuf += n;
+  if (++disk.inflight > disk.maxinflight) disk.maxinflight = disk.inflight;
 
   // avail[0] is flags
   // avail[1] tells the device how far to look in avail[2...].
   // avail[2...] are desc[] indices the device should process.
-  // we only tell device the first index in our chain of descriptors.
-  disk.avail[2 + (disk.avail[1] % NUM)] = idx[0];
+  disk.avail[2 + (disk.avail[1] % NUM)] = id;
   __sync_synchronize();
   disk.avail[1] = disk.avail[1] + 1;
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0;  // value is queue number
+}
+
+// Read or write b, and wait for the disk to finish.
+void virtio_disk_rw(struct buf *b, int write) {
+  acquire(&disk.vdisk_lock);
+  virtio_disk_submit(&b, 1, write);
 
   // Wait for virtio_disk_intr() to say request has finished.
   while (b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  release(&disk.vdisk_lock);
+}
+
+// Start reading or writing the n buffers in b, and return
+// without waiting; virtio_disk_wait() waits for each buffer.
+// Each run of consecutive blocks, up to NVIRTIOSEG long, goes
+// to the disk as a single operation. When a read finishes,
+// virtio_disk_intr() sets b->valid.
+void virtio_disk_start(struct buf **b, int n, int write) {
+  int i, j;
 
+  acquire(&disk.vdisk_lock);
+  for (i = 0; i < n; i = j) {
+    for (j = i + 1; j < n && j - i < NVIRTIOSEG && b[j]->blockno == b[j - 1]->blockno + 1; j++)
+      ;
+    virtio_disk_submit(b + i, j - i, write);
+  }
+  release(&disk.vdisk_lock);
+}
+
+// Wait until the disk is done with b, if it is using it.
+void virtio_disk_wait(struct buf *b) {
+  acquire(&disk.vdisk_lock);
+  while (b->disk == 1) {
+    sleep(b, &disk.vdisk_lock);
+  }
   release(&disk.vdisk_lock);
 }
 
 void virtio_disk_intr() {
   acquire(&disk.vdisk_lock);
 
-  while ((disk.used_idx % NUM) != (disk.used->id % NUM)) {
-    int id = disk.used->elems[disk.used_idx].id;
+  // used_idx and used->id run freely and wrap at 2^16, not NUM: with
+  // all NUM requests in flight, the device can finish every one of
+  // them between two interrupts, leaving them equal modulo NUM.
+  while (disk.used_idx != disk.used->id) {
+    __sync_synchronize();
+    int id = disk.used->elems[disk.used_idx % NUM].id;
 
     if (disk.info[id].status != 0) panic("virtio_disk_intr status");
 
-    disk.info[id].b->disk = 0;  // disk is done with buf
-    wakeup(disk.info[id].b);
+    for (int i = 0; i < disk.info[id].n; i++) {
+      struct buf *b = disk.info[id].b[i];
+      if (!disk.info[id].write) b->valid = 1;
+      b->disk = 0;  // disk is done with buf
+      wakeup(b);
+      disk.info[id].b[i] = 0;
+    }
+
+    free_desc(id);
+    disk.inflight--;
 
-    disk.used_idx = (disk.used_idx + 1) % NUM;
+    disk.used_idx++;
   }
   *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
   release(&disk.vdisk_lock);
 }
+
+// Format the driver's counters into buf, for the statistics device.
+int virtio_disk_stats(char *buf, int sz) {
+  return snprintf(buf, sz, "virtio: requests %d buffers %d max in flight %d\n", disk.nreq, disk.nbuf,
+                  disk.maxinflight);
+}
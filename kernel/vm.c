@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -15,6 +17,8 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[];  // trampoline.S
 
+static pte_t *walklevel(pagetable_t pagetable, uint64 va, int alloc, int leaf);
+
 /*
  * create a direct-map page table for the kernel.
  */
@@ -29,7 +33,7 @@ void kvminit() {
   kvmmap(VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
   // CLINT
-  kvmmap(CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+  kvmmap(KCLINT, CLINT, 0x10000, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(PLIC, PLIC, 0x400000, PTE_R | PTE_W);
@@ -64,20 +68,25 @@ void kvminithart() {
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
-pte_t *walk(pagetable_t pagetable, uint64 va, int alloc) {
+// If va lies in a megapage, returns the level-1 PTE that maps it.
+pte_t *walk(pagetable_t pagetable, uint64 va, int alloc) { return walklevel(pagetable, va, alloc, 0); }
+
+// Like walk(), but return the PTE at the given level: 0 for
+// a page, 1 for a megapage.
+static pte_t *walklevel(pagetable_t pagetable, uint64 va, int alloc, int leaf) {
   if (va >= MAXVA) panic("walk");
 
-  for (int level = 2; level > 0; level--) {
+  for (int level = 2; level > leaf; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if (*pte & PTE_V) {
+      if (PTE_LEAF(*pte)) return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if (!alloc || (pagetable = (pde_t *)kalloc()) == 0) return 0;
-      memset(pagetable, 0, PGSIZE);
+      if (!alloc || (pagetable = (pde_t *)kzalloc()) == 0) return 0;
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(leaf, va)];
 }
 
 // Look up a virtual address, return the physical address,
@@ -100,8 +109,31 @@ uint64 walkaddr(pagetable_t pagetable, uint64 va) {
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// uses megapages for the parts of the range that are aligned
+// to them, so the direct map needs fewer page-table pages and
+// TLB entries.
 void kvmmap(uint64 va, uint64 pa, uint64 sz, int perm) {
-  if (mappages(kernel_pagetable, va, sz, pa, perm) != 0) panic("kvmmap");
+  uint64 a, last, n;
+  pte_t *pte;
+
+  a = PGROUNDDOWN(va);
+  last = PGROUNDDOWN(va + sz - 1);
+  pa = PGROUNDDOWN(pa);
+  while (a <= last) {
+    if (a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && last - a >= MEGAPGSIZE - PGSIZE) {
+      if ((pte = walklevel(kernel_pagetable, a, 1, 1)) == 0) panic("kvmmap");
+      if (*pte & PTE_V) panic("remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      n = MEGAPGSIZE;
+    } else {
+      // pages up to the next megapage boundary.
+      n = MEGAPGSIZE - a % MEGAPGSIZE;
+      if (n > last - a + PGSIZE) n = last - a + PGSIZE;
+      if (mappages(kernel_pagetable, a, n, pa, perm) != 0) panic("kvmmap");
+    }
+    a += n;
+    pa += n;
+  }
 }
 
 // translate a kernel virtual address to
@@ -116,10 +148,36 @@ uint64 kvmpa(uint64 va) {
   pte = walk(kernel_pagetable, va, 0);
   if (pte == 0) panic("kvmpa");
   if ((*pte & PTE_V) == 0) panic("kvmpa");
+  if (pte == walklevel(kernel_pagetable, va, 0, 1)) off = va % MEGAPGSIZE;
   pa = PTE2PA(*pte);
   return pa + off;
 }
 
+// Count the page-table pages below pagetable, which is at the
+// given level, into n[0], and its page and megapage leaves
+// into n[1] and n[2].
+static void kvmcount(pagetable_t pagetable, int level, int *n) {
+  n[0]++;
+  for (int i = 0; i < 512; i++) {
+    pte_t pte = pagetable[i];
+    if ((pte & PTE_V) == 0) continue;
+    if (PTE_LEAF(pte))
+      n[level == 0 ? 1 : 2]++;
+    else
+      kvmcount((pagetable_t)PTE2PA(pte), level - 1, n);
+  }
+}
+
+// Format the kernel page table's size into buf, for the
+// statistics device. Every leaf is a TLB entry the kernel
+// may need, so fewer leaves means fewer TLB misses.
+int kvmstats(char *buf, int sz) {
+  int n[3] = {0, 0, 0};
+
+  kvmcount(kernel_pagetable, 2, n);
+  return snprintf(buf, sz, "kvm: page-table pages %d 4K leaves %d 2M leaves %d\n", n[0], n[1], n[2]);
+}
+
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned. Returns 0 on success, -1 if walk() couldn't
@@ -142,7 +200,8 @@ int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that sbrk() reserved but that were
+// never touched have no mapping and are skipped.
 // Optionally free the physical memory.
 void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
   uint64 a;
@@ -151,24 +210,66 @@ void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
   if ((va % PGSIZE) != 0) panic("uvmunmap: not aligned");
 
   for (a = va; a < va + npages * PGSIZE; a += PGSIZE) {
-    if ((pte = walk(pagetable, a, 0)) == 0) panic("uvmunmap: walk");
-    if ((*pte & PTE_V) == 0) panic("uvmunmap: not mapped");
-    if (PTE_FLAGS(*pte) == PTE_V) panic("uvmunmap: not a leaf");
-    if (do_free) {
-      uint64 pa = PTE2PA(*pte);
-      kfree((void *)pa);
+    if ((pte = walk(pagetable, a, 0)) == 0) continue;
+    if (*pte & PTE_V) {
+      if (PTE_FLAGS(*pte) == PTE_V) panic("uvmunmap: not a leaf");
+      if (do_free) {
+        uint64 pa = PTE2PA(*pte);
+        kfree((void *)pa);
+      }
     }
     *pte = 0;
   }
 }
 
+// Create the kernel page table for a process whose user page
+// table is pagetable: the global kernel page table, except that
+// the first 1GB is taken from pagetable, so the kernel sees the
+// process's memory at its user addresses.
+pagetable_t kvmcreate(pagetable_t pagetable) {
+  pagetable_t kpagetable;
+
+  if ((kpagetable = (pagetable_t)kalloc()) == 0) return 0;
+  memmove(kpagetable, kernel_pagetable, PGSIZE);
+  kvmsetuser(kpagetable, pagetable);
+  return kpagetable;
+}
+
+// Point kernel page table kpagetable at a new user page table.
+void kvmsetuser(pagetable_t kpagetable, pagetable_t pagetable) {
+  kpagetable[0] = pagetable[0];
+  sfence_vma();
+}
+
+// Copy the kernel's device mappings in the first 1GB, those at
+// and above USERTOP, into user page table pagetable, for the
+// process's kernel page table to use. The user can't touch
+// them, since they lack PTE_U. Returns 0, or -1 if out of memory.
+int uvmkshare(pagetable_t pagetable) {
+  pagetable_t l1, kl1;
+
+  if (walklevel(pagetable, USERTOP, 1, 1) == 0) return -1;
+  l1 = (pagetable_t)PTE2PA(pagetable[0]);
+  kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+  for (int i = PX(1, USERTOP); i < 512; i++) l1[i] = kl1[i];
+  return 0;
+}
+
+// Remove the mappings uvmkshare() added, before freeing pagetable.
+void uvmkunshare(pagetable_t pagetable) {
+  pagetable_t l1;
+
+  if ((pagetable[0] & PTE_V) == 0) return;
+  l1 = (pagetable_t)PTE2PA(pagetable[0]);
+  for (int i = PX(1, USERTOP); i < 512; i++) l1[i] = 0;
+}
+
 // create an empty user page table.
 // returns 0 if out of memory.
 pagetable_t uvmcreate() {
   pagetable_t pagetable;
-  pagetable = (pagetable_t)kalloc();
+  pagetable = (pagetable_t)kzalloc();
   if (pagetable == 0) return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -179,8 +280,7 @@ void uvminit(pagetable_t pagetable, uchar *src, uint sz) {
   char *mem;
 
   if (sz >= PGSIZE) panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W | PTE_R | PTE_X | PTE_U);
   memmove(mem, src, sz);
 }
@@ -192,15 +292,15 @@ uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz) {
   uint64 a;
 
   if (newsz < oldsz) return oldsz;
+  if (newsz > USERTOP) return 0;
 
   oldsz = PGROUNDUP(oldsz);
   for (a = oldsz; a < newsz; a += PGSIZE) {
-    mem = kalloc();
+    mem = kzalloc();
     if (mem == 0) {
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if (mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W | PTE_X | PTE_R | PTE_U) != 0) {
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -220,6 +320,8 @@ uint64 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz) {
   if (PGROUNDUP(newsz) < PGROUNDUP(oldsz)) {
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
     uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
+    // the kernel may have cached the mappings too.
+    sfence_vma();
   }
 
   return newsz;
@@ -252,43 +354,113 @@ void uvmfree(pagetable_t pagetable, uint64 sz) {
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies only the page table: both processes share
+// the physical pages, with writable ones marked
+// copy-on-write in both, until uvmfault() separates them.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int uvmcopy(pagetable_t old, pagetable_t new, uint64 sz) {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
-  uint flags;
-  char *mem;
 
   for (i = 0; i < sz; i += PGSIZE) {
-    if ((pte = walk(old, i, 0)) == 0) panic("uvmcopy: pte should exist");
-    if ((*pte & PTE_V) == 0) panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if ((mem = kalloc()) == 0) goto err;
-    memmove(mem, (char *)pa, PGSIZE);
-    if (mappages(new, i, PGSIZE, (uint64)mem, flags) != 0) {
-      kfree(mem);
-      goto err;
+    if ((pte = walk(old, i, 0)) == 0) continue;
+    if (*pte & PTE_GUARD) {
+      if ((npte = walk(new, i, 1)) == 0) goto err;
+      *npte = PTE_GUARD;
+      continue;
     }
+    if ((*pte & PTE_V) == 0) continue;  // not touched yet
+    pa = PTE2PA(*pte);
+    if (*pte & PTE_W) *pte = (*pte & ~PTE_W) | PTE_COW;
+    if (mappages(new, i, PGSIZE, pa, PTE_FLAGS(*pte)) != 0) goto err;
+    kdup((void *)pa);
   }
+  // the parent may have cached its old writable mappings.
+  sfence_vma();
   return 0;
 
 err:
   uvmunmap(new, 0, i / PGSIZE, 1);
+  sfence_vma();
   return -1;
 }
 
-// mark a PTE invalid for user access.
+// The current process, if it is the one using pagetable;
+// other page tables have no pages waiting to be faulted in.
+static struct proc *uvmproc(pagetable_t pagetable) {
+  struct proc *p = myproc();
+
+  if (p == 0 || p->pagetable != pagetable) return 0;
+  return p;
+}
+
+// Handle a page fault at user virtual address va, taken on
+// a write if write is set: allocate a page that sbrk() or
+// exec() reserved, zeroed or read from the executable, or
+// give the process its own copy of a copy-on-write page.
+// Returns 0 if the access can be retried, or -1 if it is
+// not allowed.
+int uvmfault(pagetable_t pagetable, uint64 va, int write) {
+  struct proc *p;
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+
+  if (va >= MAXVA) return -1;
+  va = PGROUNDDOWN(va);
+  pte = walk(pagetable, va, 0);
+  if (pte != 0 && (*pte & PTE_GUARD)) return -1;
+  if (pte == 0 || (*pte & PTE_V) == 0) {
+    if ((p = uvmproc(pagetable)) == 0 || va >= p->sz) return -1;
+    if ((mem = kzalloc()) == 0) return -1;
+    if (execload(p, va, mem) != 0 || mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W | PTE_X | PTE_R | PTE_U) != 0) {
+      kfree(mem);
+      return -1;
+    }
+    return 0;
+  }
+
+  if (!write || (*pte & (PTE_U | PTE_COW)) != (PTE_U | PTE_COW)) return -1;
+
+  pa = PTE2PA(*pte);
+  if (krefcnt((void *)pa) > 1) {
+    if ((mem = kalloc()) == 0) return -1;
+    memmove(mem, (char *)pa, PGSIZE);
+    *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+    kfree((void *)pa);
+  } else {
+    // the other sharers are gone; just take the page back.
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+  }
+  sfence_vma();
+  return 0;
+}
+
+// Like walkaddr(), but first fault in the page as a user
+// access would, so the kernel can touch pages that are not
+// allocated yet or are shared copy-on-write.
+static uint64 uvmaddr(pagetable_t pagetable, uint64 va, int write) {
+  pte_t *pte;
+
+  if (va >= MAXVA) return 0;
+  pte = walk(pagetable, va, 0);
+  if (pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_COW)))
+    if (uvmfault(pagetable, va, write) != 0) return 0;
+  return walkaddr(pagetable, va);
+}
+
+// mark a PTE invalid, and free its page.
 // used by exec for the user stack guard page.
+// clearing only PTE_U would not stop the kernel,
+// whose copyin() and copyout() run with SUM set.
 void uvmclear(pagetable_t pagetable, uint64 va) {
   pte_t *pte;
 
   pte = walk(pagetable, va, 0);
   if (pte == 0) panic("uvmclear");
-  *pte &= ~PTE_U;
+  if (*pte & PTE_V) kfree((void *)PTE2PA(*pte));
+  *pte = PTE_GUARD;
 }
 
 // Copy from kernel to user.
@@ -297,9 +469,11 @@ void uvmclear(pagetable_t pagetable, uint64 va) {
 int copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len) {
   uint64 n, va0, pa0;
 
+  if (uvmproc(pagetable)) return copyout_new(dstva, src, len);
+
   while (len > 0) {
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 1);
     if (pa0 == 0) return -1;
     n = PGSIZE - (dstva - va0);
     if (n > len) n = len;
@@ -318,9 +492,11 @@ int copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len) {
 int copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len) {
   uint64 n, va0, pa0;
 
+  if (uvmproc(pagetable)) return copyin_new(dst, srcva, len);
+
   while (len > 0) {
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if (pa0 == 0) return -1;
     n = PGSIZE - (srcva - va0);
     if (n > len) n = len;
@@ -341,9 +517,11 @@ int copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max) {
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if (uvmproc(pagetable)) return copyinstr_new(dst, srcva, max);
+
   while (got_null == 0 && max > 0) {
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if (pa0 == 0) return -1;
     n = PGSIZE - (srcva - va0);
     if (n > max) n = max;
@@ -0,0 +1,65 @@
+#include "param.h"
+#include "types.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+//
+// Copy to and from the current process's user memory without
+// walking its page table in software. The process's kernel page
+// table maps its user memory at the same addresses (see
+// kvmcreate()), so with sstatus.SUM set the kernel can use plain
+// loads and stores; copyuser.S does the copying, and kerneltrap()
+// handles pages that aren't present yet. It can't sleep in trap
+// context, so pages that must be read from the executable are
+// read in first, with execprefault().
+//
+
+// Copy from user to kernel.
+// Copy len bytes to dst from virtual address srcva.
+// Return 0 on success, -1 on error.
+int copyin_new(char *dst, uint64 srcva, uint64 len) {
+  struct proc *p = myproc();
+  int r;
+
+  if (srcva + len < srcva || srcva + len > p->sz) return -1;
+  execprefault(srcva, len);
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+  r = copyuser(dst, (void *)srcva, len);
+  w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+  return r;
+}
+
+// Copy from kernel to user.
+// Copy len bytes from src to virtual address dstva.
+// Return 0 on success, -1 on error.
+int copyout_new(uint64 dstva, char *src, uint64 len) {
+  struct proc *p = myproc();
+  int r;
+
+  if (dstva + len < dstva || dstva + len > p->sz) return -1;
+  execprefault(dstva, len);
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+  r = copyuser((void *)dstva, src, len);
+  w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+  return r;
+}
+
+// Copy a null-terminated string from user to kernel.
+// Copy bytes to dst from virtual address srcva,
+// until a '\0', or max.
+// Return 0 on success, -1 on error.
+int copyinstr_new(char *dst, uint64 srcva, uint64 max) {
+  struct proc *p = myproc();
+  int r;
+
+  if (srcva >= p->sz) return -1;
+  if (max > p->sz - srcva) max = p->sz - srcva;
+  execprefault(srcva, max);
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+  r = copyuserstr(dst, (char *)srcva, max);
+  w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+  return r;
+}
@@ -20,14 +20,14 @@
   } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 10000
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
 int nbitmap = FSSIZE / (BSIZE * 8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = FSSIZE / LOGDIV < LOGSIZE ? LOGSIZE : FSSIZE / LOGDIV > LOGMAX + 1 ? LOGMAX + 1 : FSSIZE / LOGDIV;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -44,6 +44,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirwrite(uint inum, struct dirent *de, int n);
 
 // convert to intel byte order
 ushort xshort(ushort x) {
@@ -66,10 +67,9 @@ uint xint(uint x) {
 
 int main(int argc, char *argv[]) {
   int i, cc, fd;
-  uint rootino, inum, off;
+  uint rootino, inum;
   struct dirent de;
   char buf[BSIZE];
-  struct dinode din;
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
@@ -80,6 +80,7 @@ int main(int argc, char *argv[]) {
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert(sizeof(struct dirindex) == sizeof(struct dirent));
 
   fsfd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0666);
   if (fsfd < 0) {
@@ -114,15 +115,10 @@ int main(int argc, char *argv[]) {
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  // the root directory's entries, other than "." and "..";
+  // dirwrite() lays them out once all are known.
+  struct dirent root[NDIRINDEX * DIRPB / 2];
+  int nroot = 0;
 
   for (i = 2; i < argc; i++) {
     // get rid of "user/"
@@ -147,22 +143,18 @@ int main(int argc, char *argv[]) {
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    assert(nroot < NDIRINDEX * DIRPB / 2);
+    bzero(&root[nroot], sizeof(de));
+    root[nroot].inum = xshort(inum);
+    strncpy(root[nroot].name, shortname, DIRSIZ);
+    nroot++;
 
     while ((cc = read(fd, buf, sizeof(buf))) > 0) iappend(inum, buf, cc);
 
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off / BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  dirwrite(rootino, root, nroot);
 
   balloc(freeblock);
 
@@ -255,7 +247,7 @@ void iappend(uint inum, void *xp, int n) {
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while (n > 0) {
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
+    assert(fbn < NDIRECT + NINDIRECT);
     if (fbn < NDIRECT) {
       if (xint(din.addrs[fbn]) == 0) {
         din.addrs[fbn] = xint(freeblock++);
@@ -283,3 +275,64 @@ void iappend(uint inum, void *xp, int n) {
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Hash a name, as the kernel's dirhash() does.
+uint dirhash(char *name) {
+  uint h = 2166136261;
+
+  for (int i = 0; i < DIRSIZ && name[i]; i++) h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+int dirhashcmp(const void *a, const void *b) {
+  uint ha = dirhash(((struct dirent *)a)->name), hb = dirhash(((struct dirent *)b)->name);
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+// Write the empty directory inum as a hashed directory (see
+// struct dirindex in kernel/fs.h) holding ".", ".." and the n
+// entries in de. Blocks are filled to half, leaving room to grow.
+void dirwrite(uint inum, struct dirent *de, int n) {
+  struct dirent blk[DIRPB];
+  struct dirindex *x = (struct dirindex *)blk;
+  struct dinode din;
+  int start[NDIRINDEX + 1];  // each block's first entry in de
+  int i, k, nblk;
+
+  qsort(de, n, sizeof(*de), dirhashcmp);
+
+  // a new block once the last is half full, unless the
+  // name's hash is the same as the previous name's.
+  start[0] = 0;
+  for (i = 1, nblk = 1; i < n; i++) {
+    if (i - start[nblk - 1] >= DIRPB / 2 && dirhash(de[i].name) != dirhash(de[i - 1].name)) {
+      assert(nblk < NDIRINDEX);
+      start[nblk++] = i;
+    }
+    assert(i - start[nblk - 1] < DIRPB);
+  }
+  start[nblk] = n;
+
+  // block 0: ".", "..", and the index.
+  bzero(blk, sizeof(blk));
+  blk[0].inum = xshort(inum);
+  strcpy(blk[0].name, ".");
+  blk[1].inum = xshort(inum);
+  strcpy(blk[1].name, "..");
+  for (k = 0; k < nblk; k++) {
+    x[2 + k / 2].blk[k % 2] = xshort(k + 1);
+    x[2 + k / 2].hash[k % 2] = xint(k == 0 ? 0 : dirhash(de[start[k]].name));
+  }
+  iappend(inum, blk, sizeof(blk));
+
+  for (k = 0; k < nblk; k++) {
+    bzero(blk, sizeof(blk));
+    memmove(blk, de + start[k], (start[k + 1] - start[k]) * sizeof(*de));
+    iappend(inum, blk, sizeof(blk));
+  }
+
+  rinode(inum, &din);
+  din.type = xshort(T_DIR | DI_HASHED);
+  winode(inum, &din);
+}
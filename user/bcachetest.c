@@ -0,0 +1,113 @@
+// Read different files from several processes at once, then
+// print the buffer cache's lock-contention counters. With a
+// lock per hash bucket, #test-and-set should stay low.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NCHILD 4
+#define NBLOCK 10
+#define N 200
+#define SZ 4096
+
+char buf[SZ];
+
+// Return the number following key in line, or 0 if key is absent.
+int field(char *line, char *key) {
+  int n = strlen(key);
+
+  for (; *line; line++)
+    if (memcmp(line, key, n) == 0) return atoi(line + n);
+  return 0;
+}
+
+// Print the buffer cache line of the statistics device and
+// return its #test-and-set counter for the bucket locks.
+int ntas(void) {
+  int n, tot = 0;
+  char *c, *line;
+
+  n = statistics(buf, SZ - 1);
+  buf[n] = '\0';
+  for (line = buf; *line; line = c + 1) {
+    if ((c = strchr(line, '\n')) == 0) break;
+    *c = '\0';
+    if (memcmp(line, "bcache", 6) != 0) continue;
+    printf("%s\n", line);
+    tot += field(line, "#test-and-set ");
+  }
+  return tot;
+}
+
+void createfile(char *name) {
+  int fd, i;
+
+  if ((fd = open(name, O_CREATE | O_WRONLY)) < 0) {
+    printf("bcachetest: create %s failed\n", name);
+    exit(1);
+  }
+  for (i = 0; i < NBLOCK; i++) {
+    if (write(fd, buf, BSIZE) != BSIZE) {
+      printf("bcachetest: write %s failed\n", name);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+void readfile(char *name) {
+  int fd, i, j;
+
+  for (i = 0; i < N; i++) {
+    if ((fd = open(name, O_RDONLY)) < 0) {
+      printf("bcachetest: open %s failed\n", name);
+      exit(1);
+    }
+    for (j = 0; j < NBLOCK; j++) {
+      if (read(fd, buf, BSIZE) != BSIZE) {
+        printf("bcachetest: read %s failed\n", name);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  char name[3];
+  int i, m, n;
+
+  printf("start bcachetest\n");
+  name[0] = 'B';
+  name[2] = '\0';
+  for (i = 0; i < NCHILD; i++) {
+    name[1] = '0' + i;
+    createfile(name);
+  }
+
+  m = ntas();
+  for (i = 0; i < NCHILD; i++) {
+    name[1] = '0' + i;
+    int pid = fork();
+    if (pid < 0) {
+      printf("fork failed\n");
+      exit(1);
+    }
+    if (pid == 0) {
+      readfile(name);
+      exit(0);
+    }
+  }
+  for (i = 0; i < NCHILD; i++) wait(0);
+  n = ntas();
+  printf("bcachetest: total #test-and-set %d\n", n - m);
+
+  for (i = 0; i < NCHILD; i++) {
+    name[1] = '0' + i;
+    unlink(name);
+  }
+  exit(0);
+}
@@ -0,0 +1,173 @@
+// Tests for copy-on-write fork.
+
+#include "kernel/types.h"
+#include "kernel/memlayout.h"
+#include "user/user.h"
+
+// Allocate more than half of physical memory, then fork;
+// this only works if fork shares pages instead of copying them.
+void simpletest() {
+  uint64 phys_size = PHYSTOP - KERNBASE;
+  int sz = (phys_size / 3) * 2;
+  char *p, *q;
+  int pid;
+
+  printf("simple: ");
+
+  p = sbrk(sz);
+  if (p == (char *)-1) {
+    printf("sbrk(%d) failed\n", sz);
+    exit(-1);
+  }
+  for (q = p; q < p + sz; q += 4096) *(int *)q = getpid();
+
+  pid = fork();
+  if (pid < 0) {
+    printf("fork() failed\n");
+    exit(-1);
+  }
+  if (pid == 0) exit(0);
+  wait(0);
+
+  if (sbrk(-sz) == (char *)-1) {
+    printf("sbrk(-%d) failed\n", sz);
+    exit(-1);
+  }
+  printf("ok\n");
+}
+
+// Three processes write to the same shared pages; each must
+// see only its own writes, and all memory must come back.
+void threetest() {
+  uint64 phys_size = PHYSTOP - KERNBASE;
+  int sz = phys_size / 4;
+  int pid1, pid2;
+  char *p, *q;
+
+  printf("three: ");
+
+  p = sbrk(sz);
+  if (p == (char *)-1) {
+    printf("sbrk(%d) failed\n", sz);
+    exit(-1);
+  }
+
+  pid1 = fork();
+  if (pid1 < 0) {
+    printf("fork failed\n");
+    exit(-1);
+  }
+  if (pid1 == 0) {
+    pid2 = fork();
+    if (pid2 < 0) {
+      printf("fork failed");
+      exit(-1);
+    }
+    if (pid2 == 0) {
+      for (q = p; q < p + (sz / 5) * 4; q += 4096) *(int *)q = getpid();
+      for (q = p; q < p + (sz / 5) * 4; q += 4096) {
+        if (*(int *)q != getpid()) {
+          printf("wrong content\n");
+          exit(-1);
+        }
+      }
+      exit(-1);
+    }
+    for (q = p; q < p + (sz / 2); q += 4096) *(int *)q = 9999;
+    exit(0);
+  }
+
+  for (q = p; q < p + sz; q += 4096) *(int *)q = getpid();
+
+  wait(0);
+  sleep(1);
+
+  for (q = p; q < p + sz; q += 4096) {
+    if (*(int *)q != getpid()) {
+      printf("wrong content\n");
+      exit(-1);
+    }
+  }
+
+  if (sbrk(-sz) == (char *)-1) {
+    printf("sbrk(-%d) failed\n", sz);
+    exit(-1);
+  }
+  printf("ok\n");
+}
+
+char junk1[4096];
+int fds[2];
+char junk2[4096];
+char buf[4096];
+char junk3[4096];
+
+// The kernel writing into a shared page, here through read(),
+// must break the sharing just as a user store does.
+void filetest() {
+  int i, j, pid;
+
+  printf("file: ");
+
+  buf[0] = 99;
+
+  for (i = 0; i < 4; i++) {
+    if (pipe(fds) != 0) {
+      printf("pipe() failed\n");
+      exit(-1);
+    }
+    pid = fork();
+    if (pid < 0) {
+      printf("fork failed\n");
+      exit(-1);
+    }
+    if (pid == 0) {
+      sleep(1);
+      if (read(fds[0], buf, sizeof(i)) != sizeof(i)) {
+        printf("error: read failed\n");
+        exit(1);
+      }
+      sleep(1);
+      j = *(int *)buf;
+      if (j != i) {
+        printf("error: read the wrong value\n");
+        exit(1);
+      }
+      exit(0);
+    }
+    if (write(fds[1], &i, sizeof(i)) != sizeof(i)) {
+      printf("error: write failed\n");
+      exit(-1);
+    }
+  }
+
+  int xstatus = 0;
+  for (i = 0; i < 4; i++) {
+    wait(&xstatus);
+    if (xstatus != 0) exit(1);
+  }
+
+  if (buf[0] != 99) {
+    printf("error: child overwrote parent\n");
+    exit(1);
+  }
+
+  printf("ok\n");
+}
+
+int main(int argc, char *argv[]) {
+  simpletest();
+
+  // check that the first simpletest() freed the physical memory.
+  simpletest();
+
+  threetest();
+  threetest();
+  threetest();
+
+  filetest();
+
+  printf("ALL COW TESTS PASSED\n");
+
+  exit(0);
+}
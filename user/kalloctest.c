@@ -0,0 +1,75 @@
+// Stress the page allocator from several processes at once,
+// then print the allocator's lock-contention counters.
+// With per-CPU caches, #test-and-set should stay near zero.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define NCHILD 4
+#define N 100000
+#define SZ 4096
+
+char buf[SZ];
+
+// Return the number following key in line, or 0 if key is absent.
+int field(char *line, char *key) {
+  int n = strlen(key);
+
+  for (; *line; line++)
+    if (memcmp(line, key, n) == 0) return atoi(line + n);
+  return 0;
+}
+
+// Print the allocator lines of the statistics device and
+// return the sum of their #test-and-set counters.
+int ntas(void) {
+  int n, tot = 0;
+  char *c, *line;
+
+  n = statistics(buf, SZ - 1);
+  buf[n] = '\0';
+  for (line = buf; *line; line = c + 1) {
+    if ((c = strchr(line, '\n')) == 0) break;
+    *c = '\0';
+    if (memcmp(line, "kmem", 4) != 0 && memcmp(line, "buddy", 5) != 0) continue;
+    printf("%s\n", line);
+    tot += field(line, "#test-and-set ");
+  }
+  return tot;
+}
+
+int main(int argc, char *argv[]) {
+  int i, j, pid, m, n;
+  char *a;
+
+  printf("start kalloctest\n");
+  m = ntas();
+  for (i = 0; i < NCHILD; i++) {
+    pid = fork();
+    if (pid < 0) {
+      printf("fork failed\n");
+      exit(1);
+    }
+    if (pid == 0) {
+      for (j = 0; j < N; j++) {
+        a = sbrk(4096);
+        if (a == (char *)-1) {
+          printf("sbrk failed\n");
+          exit(1);
+        }
+        *(int *)(a + 4) = 1;
+        if (sbrk(-4096) == (char *)-1) {
+          printf("sbrk failed\n");
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+  }
+  for (i = 0; i < NCHILD; i++) wait(0);
+  n = ntas();
+  printf("kalloctest: total #test-and-set %d\n", n - m);
+  exit(0);
+}
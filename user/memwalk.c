@@ -0,0 +1,40 @@
+// Walk a large region of memory repeatedly, so that the kernel
+// zeroes and frees each page through its direct map, and print
+// the time taken and the size of the kernel page table. With
+// megapages the direct map needs far fewer TLB entries.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define SZ (32 * 1024 * 1024)
+#define ROUNDS 8
+
+char buf[4096];
+
+int main(int argc, char *argv[]) {
+  int i, n, t0, t1;
+  char *a, *p, *line, *c;
+
+  t0 = uptime();
+  for (i = 0; i < ROUNDS; i++) {
+    a = sbrk(SZ);
+    if (a == (char *)-1) {
+      printf("memwalk: sbrk failed\n");
+      exit(1);
+    }
+    for (p = a; p < a + SZ; p += PGSIZE) *p = i;
+    sbrk(-SZ);
+  }
+  t1 = uptime();
+  printf("memwalk: %d rounds of %d pages in %d ticks\n", ROUNDS, SZ / PGSIZE, t1 - t0);
+
+  n = statistics(buf, sizeof(buf) - 1);
+  buf[n] = '\0';
+  for (line = buf; (c = strchr(line, '\n')) != 0; line = c + 1) {
+    *c = '\0';
+    if (memcmp(line, "kvm", 3) == 0) printf("%s\n", line);
+  }
+  exit(0);
+}
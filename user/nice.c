@@ -0,0 +1,17 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(2, "usage: nice level command [arg...]\n");
+    exit(1);
+  }
+  if (setpriority(0, atoi(argv[1])) < 0) {
+    fprintf(2, "nice: bad level %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "nice: exec %s failed\n", argv[2]);
+  exit(1);
+}
@@ -0,0 +1,38 @@
+// Measure read() throughput with 64 KiB reads of a file that
+// stays in the buffer cache, so that the time goes mostly into
+// system call overhead and copying out to user memory.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define SZ (64 * 1024)
+#define N 2000
+
+char buf[SZ];
+
+int main(int argc, char *argv[]) {
+  int fd, i, t0, t1;
+
+  for (i = 0; i < SZ; i++) buf[i] = i;
+  if ((fd = open("readbench.tmp", O_CREATE | O_RDWR)) < 0 || write(fd, buf, SZ) != SZ) {
+    printf("readbench: cannot create file\n");
+    exit(1);
+  }
+  close(fd);
+
+  t0 = uptime();
+  for (i = 0; i < N; i++) {
+    if ((fd = open("readbench.tmp", O_RDONLY)) < 0 || read(fd, buf, SZ) != SZ) {
+      printf("readbench: read failed\n");
+      exit(1);
+    }
+    close(fd);
+  }
+  t1 = uptime();
+  unlink("readbench.tmp");
+
+  printf("readbench: %d reads of %d bytes in %d ticks\n", N, SZ, t1 - t0);
+  exit(0);
+}
@@ -0,0 +1,16 @@
+// stats: print the kernel's statistics.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define SZ 4096
+char buf[SZ];
+
+int main(void) {
+  int n;
+
+  n = statistics(buf, SZ);
+  write(1, buf, n);
+  exit(0);
+}
@@ -494,7 +494,10 @@ void writetest(char *s) {
   }
 }
 
+// a file long enough to use two of the indirect blocks
+// under its doubly-indirect block.
 void writebig(char *s) {
+  enum { N = NDIRECT + 3 * NINDIRECT };
   int i, fd, n;
 
   fd = open("big", O_CREATE | O_RDWR);
@@ -503,7 +506,7 @@ void writebig(char *s) {
     exit(1);
   }
 
-  for (i = 0; i < MAXFILE; i++) {
+  for (i = 0; i < N; i++) {
     ((int *)buf)[0] = i;
     if (write(fd, buf, BSIZE) != BSIZE) {
       printf("%s: error: write big file failed\n", i);
@@ -523,7 +526,7 @@ void writebig(char *s) {
   for (;;) {
     i = read(fd, buf, BSIZE);
     if (i == 0) {
-      if (n == MAXFILE - 1) {
+      if (n != N) {
         printf("%s: read only %d blocks from big", n);
         exit(1);
       }
@@ -641,6 +644,79 @@ void exectest(char *s) {
   }
 }
 
+// a running program's pages are read from its file on demand,
+// so the file can't be opened for writing while it runs, and a
+// file open for writing can't be run.
+void execwrite(char *s) {
+  char *args[] = {"exw", 0};
+  int fd, efd, n, pid, xstatus;
+
+  if (open("usertests", O_RDWR) >= 0 || open("usertests", O_WRONLY) >= 0 ||
+      open("usertests", O_RDONLY | O_TRUNC) >= 0) {
+    printf("%s: opened running usertests for writing\n", s);
+    exit(1);
+  }
+  if ((fd = open("usertests", O_RDONLY)) < 0) {
+    printf("%s: open usertests for reading failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // copy echo to exw, and keep exw open for writing.
+  unlink("exw");
+  if ((efd = open("echo", O_RDONLY)) < 0 || (fd = open("exw", O_CREATE | O_RDWR)) < 0) {
+    printf("%s: open echo or exw failed\n", s);
+    exit(1);
+  }
+  while ((n = read(efd, buf, sizeof(buf))) > 0) {
+    if (write(fd, buf, n) != n) {
+      printf("%s: write exw failed\n", s);
+      exit(1);
+    }
+  }
+  close(efd);
+
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    close(1);
+    exec("exw", args);
+    exit(7);  // echo would exit 0
+  }
+  wait(&xstatus);
+  if (xstatus != 7) {
+    printf("%s: ran exw while it was open for writing\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    close(1);
+    exec("exw", args);
+    exit(1);
+  }
+  wait(&xstatus);
+  if (xstatus != 0) {
+    printf("%s: exec exw failed\n", s);
+    exit(1);
+  }
+
+  if ((fd = open("exw", O_RDWR)) < 0) {
+    printf("%s: open exw after it ran failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("exw");
+}
+
 // simple fork and pipe read/write
 
 void pipe1(char *s) {
@@ -771,6 +847,35 @@ void exitwait(char *s) {
   }
 }
 
+// setpriority() returns the old level, refuses levels and pids
+// that don't exist, and fork() passes the level on.
+void priority(char *s) {
+  int pid, xstate;
+
+  if (setpriority(0, -1) != -1 || setpriority(0, NPRIO) != -1) {
+    printf("%s: setpriority accepted a bad level\n", s);
+    exit(1);
+  }
+  if (setpriority(0, NPRIO - 1) != 0 || setpriority(getpid(), 1) != NPRIO - 1) {
+    printf("%s: setpriority returned the wrong level\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) exit(setpriority(0, 0));
+  if (wait(&xstate) != pid || xstate != 1) {
+    printf("%s: child did not inherit its level\n", s);
+    exit(1);
+  }
+  if (setpriority(pid, 0) != -1) {
+    printf("%s: setpriority of a dead process\n", s);
+    exit(1);
+  }
+}
+
 // try to find races in the reparenting
 // code that handles a parent exiting
 // when it still has live children.
@@ -1394,6 +1499,76 @@ void bigdir(char *s) {
   }
 }
 
+static void hdname(char *name, int i) {
+  name[0] = 'h';
+  name[1] = '0' + (i / 1000) % 10;
+  name[2] = '0' + (i / 100) % 10;
+  name[3] = '0' + (i / 10) % 10;
+  name[4] = '0' + i % 10;
+  name[5] = '\0';
+}
+
+// thousands of files in one directory, enough to split its
+// hash blocks many times; then fill it until create fails.
+void hashdir(char *s) {
+  enum { N = 2000 };
+  int i, n, fd;
+  char name[8];
+
+  if (mkdir("hd") != 0 || chdir("hd") != 0) {
+    printf("%s: mkdir hd failed\n", s);
+    exit(1);
+  }
+  for (i = 0; i < N; i++) {
+    hdname(name, i);
+    if ((fd = open(name, O_CREATE | O_RDWR)) < 0) {
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  for (i = 0; i < N; i++) {
+    hdname(name, i);
+    if ((fd = open(name, 0)) < 0) {
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  for (n = N;; n++) {
+    if (n > NDIRINDEX * DIRPB) {
+      printf("%s: directory never filled up\n", s);
+      exit(1);
+    }
+    hdname(name, n);
+    if ((fd = open(name, O_CREATE | O_RDWR)) < 0) break;
+    close(fd);
+  }
+  // the failed create must leave no entry and lose no others.
+  if ((fd = open(name, 0)) >= 0) {
+    printf("%s: failed create of %s left an entry\n", s, name);
+    exit(1);
+  }
+  for (i = 0; i < n; i++) {
+    hdname(name, i);
+    if ((fd = open(name, 0)) < 0) {
+      printf("%s: open %s after full failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    if (unlink(name) != 0) {
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+
+  if (chdir("..") != 0 || unlink("hd") != 0) {
+    printf("%s: unlink hd failed\n", s);
+    exit(1);
+  }
+}
+
 void subdir(char *s) {
   int fd, cc;
 
@@ -1645,6 +1820,97 @@ void bigfile(char *s) {
   unlink("bigfile.dat");
 }
 
+// two descriptors reading one file in turn, so the inode sees
+// reads that don't follow on from the previous one, interleaved
+// with sequential runs that start read-ahead.
+void readahead(char *s) {
+  enum { N = 40 };
+  int fd, fd1, fd2, i, j;
+
+  unlink("readahead.dat");
+  fd = open("readahead.dat", O_CREATE | O_RDWR);
+  if (fd < 0) {
+    printf("%s: cannot create readahead.dat\n", s);
+    exit(1);
+  }
+  for (i = 0; i < N; i++) {
+    memset(buf, i, BSIZE);
+    if (write(fd, buf, BSIZE) != BSIZE) {
+      printf("%s: write readahead.dat failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd1 = open("readahead.dat", O_RDONLY);
+  fd2 = open("readahead.dat", O_RDONLY);
+  if (fd1 < 0 || fd2 < 0) {
+    printf("%s: cannot open readahead.dat\n", s);
+    exit(1);
+  }
+  for (i = 0; i < N; i++) {
+    // fd1 reads block i in one go; fd2 has fallen behind and
+    // reads block i/2 in two halves.
+    if (read(fd1, buf, BSIZE) != BSIZE || buf[0] != i || buf[BSIZE - 1] != i) {
+      printf("%s: read readahead.dat wrong data\n", s);
+      exit(1);
+    }
+    if (read(fd2, buf, BSIZE / 2) != BSIZE / 2) {
+      printf("%s: read readahead.dat failed\n", s);
+      exit(1);
+    }
+    for (j = 0; j < BSIZE / 2; j++) {
+      if (buf[j] != i / 2) {
+        printf("%s: read readahead.dat wrong data\n", s);
+        exit(1);
+      }
+    }
+  }
+  close(fd1);
+  close(fd2);
+  unlink("readahead.dat");
+}
+
+// a file mapped by extents, written past where a block-mapped
+// file would need its doubly-indirect block.
+void extentfile(char *s) {
+  enum { N = NDIRECT + NINDIRECT + 20 };
+  int fd, i;
+
+  unlink("extent.dat");
+  fd = open("extent.dat", O_CREATE | O_RDWR | O_EXTENT);
+  if (fd < 0) {
+    printf("%s: cannot create extent.dat\n", s);
+    exit(1);
+  }
+  for (i = 0; i < N; i++) {
+    ((int *)buf)[0] = i;
+    if (write(fd, buf, BSIZE) != BSIZE) {
+      printf("%s: write extent.dat failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("extent.dat", O_RDONLY);
+  if (fd < 0) {
+    printf("%s: cannot open extent.dat\n", s);
+    exit(1);
+  }
+  for (i = 0; i < N; i++) {
+    if (read(fd, buf, BSIZE) != BSIZE || ((int *)buf)[0] != i) {
+      printf("%s: read extent.dat wrong data\n", s);
+      exit(1);
+    }
+  }
+  if (read(fd, buf, BSIZE) != 0) {
+    printf("%s: extent.dat too long\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("extent.dat");
+}
+
 void fourteen(char *s) {
   int fd;
 
@@ -2513,6 +2779,7 @@ int main(int argc, char *argv[]) {
       {fourfiles, "fourfiles"},
       {sharedfd, "sharedfd"},
       {exectest, "exectest"},
+      {execwrite, "execwrite"},
       {bigargtest, "bigargtest"},
       {bigwrite, "bigwrite"},
       {bsstest, "bsstest"},
@@ -2534,13 +2801,17 @@ int main(int argc, char *argv[]) {
       {pipe1, "pipe1"},
       {preempt, "preempt"},
       {exitwait, "exitwait"},
+      {priority, "priority"},
       {rmdot, "rmdot"},
       {fourteen, "fourteen"},
       {bigfile, "bigfile"},
+      {readahead, "readahead"},
+      {extentfile, "extentfile"},
       {dirfile, "dirfile"},
       {iref, "iref"},
       {forktest, "forktest"},
       {bigdir, "bigdir"},  // slow
+      {hashdir, "hashdir"},  // slow
       {0, 0},
   };
 